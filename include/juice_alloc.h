@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Memory hooks for libjuice and the port layer.
+ *
+ * With CONFIG_ESP_ICE_ALLOCATOR_HOOKS, every malloc/calloc/realloc/free in
+ * libjuice is routed through juice_malloc() and friends, which use either the
+ * allocator set by juice_set_allocator() or a static arena of fixed-size pools
+ * set by juice_set_static_arena(). Both must be configured before the first
+ * agent or server is created, and cannot be changed while allocations are alive.
+ */
+
+typedef struct {
+    void *(*malloc)(size_t size, void *user_ptr);
+    void *(*realloc)(void *ptr, size_t size, void *user_ptr);
+    void (*free)(void *ptr, void *user_ptr);
+    void *user_ptr;
+} juice_allocator_t;
+
+#define JUICE_ARENA_MAX_POOLS 8
+
+typedef struct {
+    size_t block_size;
+    size_t block_count;
+} juice_arena_pool_config_t;
+
+typedef struct {
+    void *buffer;                           // Caller-owned, must outlive every allocation
+    size_t size;
+    const juice_arena_pool_config_t *pools; // Sorted by increasing block_size
+    size_t pools_count;                     // Up to JUICE_ARENA_MAX_POOLS
+} juice_arena_config_t;
+
+typedef struct {
+    size_t allocations;         // Outstanding allocations
+    size_t allocations_peak;
+    size_t bytes_in_use;        // Arena mode only, counted in whole blocks
+    size_t bytes_peak;          // Arena mode only, high-water mark
+    size_t failures;            // Allocations that returned NULL
+} juice_alloc_stats_t;
+
+typedef struct {
+    size_t block_size;
+    size_t block_count;
+    size_t blocks_in_use;
+    size_t blocks_peak;
+} juice_arena_pool_stats_t;
+
+/**
+ * Set the allocator, or restore the C library one if alloc is NULL.
+ * Returns -1 if allocations made with the current allocator are still alive.
+ */
+int juice_set_allocator(const juice_allocator_t *alloc);
+
+/**
+ * Serve every allocation from fixed-size pools carved out of config->buffer.
+ * An allocation takes a block from the smallest pool that fits and has a free
+ * block; there is no fallback to the heap, exhaustion returns NULL.
+ * Returns -1 if the pools do not fit in the buffer or allocations are alive.
+ */
+int juice_set_static_arena(const juice_arena_config_t *config);
+
+void juice_get_alloc_stats(juice_alloc_stats_t *stats);
+
+/**
+ * Per pool statistics in arena mode, used to size the pools from the
+ * high-water marks of a representative run. Returns -1 if index is out of range.
+ */
+int juice_get_arena_pool_stats(size_t index, juice_arena_pool_stats_t *stats);
+
+void *juice_malloc(size_t size);
+void *juice_calloc(size_t nmemb, size_t size);
+void *juice_realloc(void *ptr, size_t size);
+void juice_free(void *ptr);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "juice/juice.h"
+
+/*
+ * Happy-Eyeballs-style racing of IPv6 and IPv4 pairs (RFC 8305) for agents on
+ * a dual-stack socket.
+ *
+ * Remote IPv4 candidates are held back for a head start after the first remote
+ * IPv6 candidate, so a working IPv6 path wins over a NATed or relayed IPv4
+ * one, while a broken IPv6 path only costs the head start. IPv4 candidates
+ * received first wait the RFC 8305 resolution delay for IPv6 ones. Held back
+ * candidates are kept as a fallback while the agent is connected, dropped once
+ * it completes, and released at once when it fails or when the remote side has
+ * no IPv6 candidate at all.
+ *
+ * The agent is created through the wrapper, which interposes its callbacks to
+ * follow the state and sets juice_config_t.dual_stack: without a bind address,
+ * its socket is bound to the IPv6 wildcard and accepts both families. Other
+ * agents keep an IPv4 socket. Remote descriptions and candidates must go
+ * through the wrapper, everything else uses the juice API on
+ * juice_dual_stack_get_agent(). Held back candidates are added from the
+ * esp_timer task. Dual-stack agents gather and receive candidates of both
+ * families, CONFIG_ESP_ICE_MAX_CANDIDATES should leave room for them.
+ */
+
+#ifdef CONFIG_ESP_ICE_DUAL_STACK_HEAD_START_MS
+#define JUICE_DUAL_STACK_DEFAULT_HEAD_START_MS CONFIG_ESP_ICE_DUAL_STACK_HEAD_START_MS
+#else
+#define JUICE_DUAL_STACK_DEFAULT_HEAD_START_MS 250
+#endif
+
+#define JUICE_DUAL_STACK_RESOLUTION_DELAY_MS 50
+#define JUICE_DUAL_STACK_MAX_DEFERRED 8
+
+typedef struct juice_dual_stack juice_dual_stack_t;
+
+typedef struct {
+    int head_start_ms;          // 0 for the default, negative to add IPv4 candidates immediately
+} juice_dual_stack_config_t;
+
+typedef struct {
+    int family;                 // Family of the selected pair, AF_INET or AF_INET6, 0 until connected
+    int64_t connected_ms;       // From juice_dual_stack_create() to connected, -1 until then
+    unsigned deferred;          // Remote IPv4 candidates held back
+    unsigned dropped;           // Held back candidates never added since the agent completed first
+} juice_dual_stack_stats_t;
+
+/**
+ * Create an agent with the given configuration, callbacks included.
+ * Returns NULL on failure.
+ */
+juice_dual_stack_t *juice_dual_stack_create(const juice_config_t *config, const juice_dual_stack_config_t *ds_config);
+
+void juice_dual_stack_destroy(juice_dual_stack_t *ds);
+
+juice_agent_t *juice_dual_stack_get_agent(juice_dual_stack_t *ds);
+
+/**
+ * Same as the juice functions, with IPv4 candidates held back during the
+ * IPv6 head start, including those embedded in the description.
+ */
+int juice_dual_stack_set_remote_description(juice_dual_stack_t *ds, const char *sdp);
+int juice_dual_stack_add_remote_candidate(juice_dual_stack_t *ds, const char *sdp);
+int juice_dual_stack_set_remote_gathering_done(juice_dual_stack_t *ds);
+
+void juice_dual_stack_get_stats(juice_dual_stack_t *ds, juice_dual_stack_stats_t *stats);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "juice/juice.h"
+
+/*
+ * Zero-copy framing of relayed datagrams.
+ *
+ * The payload is written once into a buffer that keeps JUICE_SEND_HEADROOM
+ * bytes free in front of it and JUICE_SEND_TAILROOM bytes behind it. The
+ * ChannelData header, or the Send indication header and attributes, are then
+ * written in place around the payload instead of copying it into a new buffer
+ * as turn_wrap_channel_data() and stun_write() do.
+ *
+ * juice_send_buf() is the agent entry point: on a relayed pair the ChannelData
+ * header, or a Send indication while the channel is being bound, is written in
+ * place and the buffer goes to the socket as is. On a direct pair it behaves
+ * like juice_send().
+ */
+
+#define JUICE_CHANNEL_DATA_HEADROOM 4
+// STUN header + XOR-PEER-ADDRESS (IPv6) + DATA attribute header
+#define JUICE_SEND_INDICATION_HEADROOM (20 + 4 + 20 + 4)
+#define JUICE_SEND_HEADROOM JUICE_SEND_INDICATION_HEADROOM
+// Attribute padding + FINGERPRINT
+#define JUICE_SEND_TAILROOM (3 + 8)
+// Largest payload whose Send indication length still fits the 16-bit STUN length
+#define JUICE_SEND_MAX_PAYLOAD (UINT16_MAX - (JUICE_SEND_HEADROOM - 20) - JUICE_SEND_TAILROOM)
+
+typedef struct juice_sendbuf {
+    uint8_t *storage;
+    size_t capacity;
+    size_t len;         // Payload length, the payload starts at storage + JUICE_SEND_HEADROOM
+} juice_sendbuf_t;
+
+/**
+ * Initialize a send buffer over caller-owned storage of at least
+ * JUICE_SEND_HEADROOM + JUICE_SEND_TAILROOM bytes.
+ */
+int juice_sendbuf_init(juice_sendbuf_t *sb, void *storage, size_t capacity);
+
+static inline uint8_t *juice_sendbuf_payload(juice_sendbuf_t *sb)
+{
+    return sb->storage + JUICE_SEND_HEADROOM;
+}
+
+static inline size_t juice_sendbuf_payload_capacity(const juice_sendbuf_t *sb)
+{
+    return sb->capacity - JUICE_SEND_HEADROOM - JUICE_SEND_TAILROOM;
+}
+
+/**
+ * Set the length of the payload written through juice_sendbuf_payload().
+ * Fails if it exceeds the capacity or JUICE_SEND_MAX_PAYLOAD.
+ */
+int juice_sendbuf_set_len(juice_sendbuf_t *sb, size_t len);
+
+/**
+ * Write the ChannelData header in front of the payload.
+ * On success frame and frame_len describe the datagram to send. Padding is not
+ * added, as it is optional over UDP (RFC 8656 12.5).
+ */
+int juice_frame_channel_data(juice_sendbuf_t *sb, uint16_t channel,
+                             const uint8_t **frame, size_t *frame_len);
+
+/**
+ * Write a Send indication (XOR-PEER-ADDRESS, DATA and optionally FINGERPRINT)
+ * around the payload. transaction_id must point to 12 random bytes.
+ */
+int juice_frame_send_indication(juice_sendbuf_t *sb, const struct sockaddr *peer,
+                                const uint8_t *transaction_id, bool fingerprint,
+                                const uint8_t **frame, size_t *frame_len);
+
+/**
+ * Send the payload of sb to the selected pair, framing it in place if it is
+ * relayed. The buffer is modified around the payload, the payload itself is
+ * left intact so sb can be sent again.
+ * Returns JUICE_ERR_SUCCESS, or JUICE_ERR_INVALID / JUICE_ERR_FAILED.
+ */
+int juice_send_buf(juice_agent_t *agent, juice_sendbuf_t *sb);
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * First-stage demultiplexer for the per-datagram receive path.
+ *
+ * juice_pkt_classify() looks at the first bytes only and rejects malformed
+ * STUN/ChannelData before libjuice runs stun_read() over every attribute.
+ * Anything that is not recognisably STUN (or ChannelData from a TURN server)
+ * is application data: a payload starting with 0x00-0x03 or 0x40-0x4F is
+ * never dropped on its first byte alone.
+ * juice_stun_fast_parse() then locates just the attributes the caller asks
+ * for, without copying or decoding them.
+ */
+
+#define JUICE_STUN_HEADER_SIZE      20
+#define JUICE_STUN_MAGIC            0x2112A442
+#define JUICE_STUN_TRANSACTION_SIZE 12
+#define JUICE_CHANNEL_DATA_HEADER_SIZE 4
+
+typedef enum {
+    JUICE_PKT_APP = 0,          // Application datagram, deliver as is
+    JUICE_PKT_STUN,             // Well-formed STUN header
+    JUICE_PKT_CHANNEL_DATA,     // Well-formed TURN ChannelData header, from a TURN server only
+    JUICE_PKT_INVALID,          // STUN or ChannelData that is malformed or foreign, drop it
+} juice_pkt_class_t;
+
+typedef enum {
+    JUICE_STUN_CLASS_REQUEST = 0x0000,
+    JUICE_STUN_CLASS_INDICATION = 0x0010,
+    JUICE_STUN_CLASS_RESP_SUCCESS = 0x0100,
+    JUICE_STUN_CLASS_RESP_ERROR = 0x0110,
+} juice_stun_class_t;
+
+typedef struct {
+    juice_stun_class_t msg_class;
+    uint16_t method;
+    uint16_t length;                // Attributes length, excluding the header
+    const uint8_t *transaction_id;  // Points into the datagram
+} juice_stun_header_t;
+
+typedef struct {
+    uint16_t channel;
+    uint16_t length;                // Payload length, excluding the header and padding
+    const uint8_t *payload;         // Points into the datagram
+} juice_channel_data_header_t;
+
+/**
+ * Classify a datagram from its first bytes (RFC 7983 demultiplexing).
+ *
+ * A datagram is STUN only if its first byte is 0-3 and it carries the magic
+ * cookie; its header is then validated (length matching the datagram, 4-byte
+ * alignment) and stored in *stun if not NULL. ChannelData is only expected
+ * from a TURN server (from_relay, i.e. the source is a relay entry, as in
+ * libjuice's agent_input()): its channel range and length are validated and
+ * stored in *chan if not NULL. Everything else is JUICE_PKT_APP.
+ */
+juice_pkt_class_t juice_pkt_classify(const void *data, size_t size, bool from_relay,
+                                     juice_stun_header_t *stun,
+                                     juice_channel_data_header_t *chan);
+
+/**
+ * Callback telling whether a transaction ID belongs to an outstanding request
+ * (e.g. a lookup in the agent's STUN entries).
+ */
+typedef bool (*juice_stun_txn_lookup_t)(const uint8_t *transaction_id, void *user_ptr);
+
+/**
+ * Second step of the fast path: a response must answer one of our
+ * transactions, otherwise it is foreign and dropped before any attribute is
+ * read. Requests and indications always pass. A NULL lookup accepts everything.
+ */
+bool juice_stun_fast_accept(const juice_stun_header_t *stun,
+                            juice_stun_txn_lookup_t lookup, void *user_ptr);
+
+typedef enum {
+    JUICE_STUN_ATTR_MAPPED_ADDRESS,
+    JUICE_STUN_ATTR_XOR_MAPPED_ADDRESS,
+    JUICE_STUN_ATTR_USERNAME,
+    JUICE_STUN_ATTR_MESSAGE_INTEGRITY,
+    JUICE_STUN_ATTR_MESSAGE_INTEGRITY_SHA256,
+    JUICE_STUN_ATTR_FINGERPRINT,
+    JUICE_STUN_ATTR_ERROR_CODE,
+    JUICE_STUN_ATTR_PRIORITY,
+    JUICE_STUN_ATTR_USE_CANDIDATE,
+    JUICE_STUN_ATTR_ICE_CONTROLLED,
+    JUICE_STUN_ATTR_ICE_CONTROLLING,
+    JUICE_STUN_ATTR_CHANNEL_NUMBER,
+    JUICE_STUN_ATTR_XOR_PEER_ADDRESS,
+    JUICE_STUN_ATTR_XOR_RELAYED_ADDRESS,
+    JUICE_STUN_ATTR_DATA,
+    JUICE_STUN_ATTR_LIFETIME,
+    JUICE_STUN_ATTR_COUNT
+} juice_stun_attr_id_t;
+
+#define JUICE_STUN_ATTR_BIT(id) (1u << (id))
+
+typedef struct {
+    const uint8_t *value;   // NULL if the attribute is absent or was not requested
+    uint16_t length;
+    uint16_t offset;        // Offset of the attribute header from the start of the message
+} juice_stun_attr_view_t;
+
+typedef struct {
+    uint32_t found;         // Bitmask of JUICE_STUN_ATTR_BIT() for attributes located
+    juice_stun_attr_view_t attrs[JUICE_STUN_ATTR_COUNT];
+} juice_stun_fast_msg_t;
+
+/**
+ * Walk the attribute list of a message already accepted by juice_pkt_classify()
+ * and record the position of the attributes in wanted_mask only.
+ *
+ * TLV bounds are always checked, attributes following MESSAGE-INTEGRITY other
+ * than MESSAGE-INTEGRITY-SHA256 and FINGERPRINT, or anything following
+ * FINGERPRINT, are rejected. Returns 0 on success, -1 if the message is malformed.
+ */
+int juice_stun_fast_parse(const void *data, size_t size, uint32_t wanted_mask,
+                          juice_stun_fast_msg_t *msg);
+
+/**
+ * Check the FINGERPRINT attribute located by juice_stun_fast_parse(), which is
+ * much cheaper than the HMAC and filters out foreign STUN early.
+ * Returns true if it is absent or valid.
+ */
+bool juice_stun_fast_check_fingerprint(const void *data, const juice_stun_fast_msg_t *msg);
+
+/**
+ * Receive-path entry point, called by libjuice's agent_input() before
+ * stun_read() (see esp-ice-libjuice-stun-fast.patch.txt): classifies the
+ * datagram, drops responses that answer none of the agent's transactions
+ * (lookup over its STUN entries) and STUN with bad attribute bounds or a bad
+ * FINGERPRINT, and counts the outcome. ChannelData is not told apart here,
+ * libjuice handles it once the source is known to be a relay entry.
+ * Returns the class, JUICE_PKT_INVALID meaning the datagram must be dropped.
+ */
+juice_pkt_class_t juice_stun_fast_demux(const void *data, size_t size,
+                                        juice_stun_txn_lookup_t lookup, void *user_ptr);
+
+/**
+ * Enable or disable the fast path in agent_input() at run time (enabled by
+ * default); when disabled, every datagram takes libjuice's original path.
+ */
+void juice_stun_fast_set_enabled(bool enabled);
+bool juice_stun_fast_is_enabled(void);
+
+typedef struct {
+    uint32_t app;           // Application datagrams
+    uint32_t stun;          // STUN messages handed to stun_read()
+    uint32_t dropped;       // Malformed or foreign datagrams dropped before stun_read()
+} juice_stun_fast_stats_t;
+
+void juice_stun_fast_get_stats(juice_stun_fast_stats_t *stats, bool reset);
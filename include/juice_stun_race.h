@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "sdkconfig.h"
+#include "juice/juice.h"
+
+/*
+ * Parallel STUN server racing during gathering.
+ *
+ * Agents configured with juice_config_t.stun_servers query all of them from
+ * their own socket while gathering (esp-ice-libjuice-stun-race.patch.txt).
+ * Once the host candidates are added, every name is resolved by its own task,
+ * numeric addresses in place, and the server entry is added to the agent as
+ * soon as its lookup completes, so that a slow DNS answer only delays its own
+ * server.
+ * A Binding response becomes a server-reflexive candidate right away. Once
+ * juice_config_t.stun_min_responses servers answered for an address family
+ * (local base), the requests still pending are cancelled, and gathering is
+ * done when every family with servers is settled.
+ *
+ * The functions below are the agent side of the race and are called by the
+ * patched libjuice.
+ */
+
+#define JUICE_STUN_RACE_MAX_SERVERS 8
+#define JUICE_STUN_RACE_MAX_RECORDS 2       // Addresses kept per server, one per family
+#define JUICE_STUN_RACE_ENTRIES_COUNT CONFIG_ESP_ICE_STUN_RACE_ENTRIES  // Agent STUN entries added for them
+
+typedef struct juice_stun_gather juice_stun_gather_t;
+
+/**
+ * Called from the lookup task, or from juice_stun_gather_start() for numeric
+ * addresses, once the name of server index is resolved. count is 0 if the
+ * lookup failed. The callee adds the entries, then calls
+ * juice_stun_gather_mark_added().
+ */
+typedef void (*juice_stun_gather_cb_t)(int index, const struct sockaddr_storage *records,
+                                       const socklen_t *lens, size_t count, void *user_ptr);
+
+/**
+ * Copy up to JUICE_STUN_RACE_MAX_SERVERS servers. min_responses <= 0 means 1,
+ * the first response wins. Returns NULL on allocation failure.
+ */
+juice_stun_gather_t *juice_stun_gather_create(const juice_stun_server_t *servers, size_t count,
+                                              int min_responses);
+
+/**
+ * Start every lookup in parallel. Returns -1 if already started.
+ */
+int juice_stun_gather_start(juice_stun_gather_t *gather, juice_stun_gather_cb_t cb, void *user_ptr);
+
+/**
+ * Drop the results of the lookups still running, without waiting for them.
+ */
+void juice_stun_gather_stop(juice_stun_gather_t *gather);
+
+bool juice_stun_gather_is_stopped(juice_stun_gather_t *gather);
+
+/**
+ * The entries of one more server were added, or its lookup failed.
+ */
+void juice_stun_gather_mark_added(juice_stun_gather_t *gather);
+
+/**
+ * Whether juice_stun_gather_start() has not returned yet or some lookups have
+ * not been marked added, unless stopped.
+ */
+bool juice_stun_gather_pending(juice_stun_gather_t *gather);
+
+int juice_stun_gather_min_responses(const juice_stun_gather_t *gather);
+
+/**
+ * Stop the lookups and wait for a callback in progress to return. The memory
+ * is released when the last lookup task exits. NULL is ignored.
+ */
+void juice_stun_gather_destroy(juice_stun_gather_t *gather);
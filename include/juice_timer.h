@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "juice/juice.h"
+
+/*
+ * Timer service shared by all agents of a conn backend.
+ *
+ * Each timer may fire anywhere in [deadline, deadline + slack]. The service
+ * wakes at the latest instant that still satisfies every armed timer, aligned
+ * down on a common grid when possible, and fires all timers due at that
+ * instant in one batch. Keepalives, consent checks and TURN refreshes of
+ * several agents then share wakeups instead of each getting their own.
+ *
+ * Timers are owned by the caller and linked into the service, nothing is
+ * allocated. The service is not thread-safe, call it under the conn lock.
+ */
+
+#ifdef CONFIG_ESP_ICE_TIMER_SLACK_MS
+#define JUICE_TIMER_DEFAULT_SLACK_MS CONFIG_ESP_ICE_TIMER_SLACK_MS
+#else
+#define JUICE_TIMER_DEFAULT_SLACK_MS 500
+#endif
+
+#ifdef CONFIG_ESP_ICE_TIMER_GRANULARITY_MS
+#define JUICE_TIMER_DEFAULT_GRANULARITY_MS CONFIG_ESP_ICE_TIMER_GRANULARITY_MS
+#else
+#define JUICE_TIMER_DEFAULT_GRANULARITY_MS 250
+#endif
+
+typedef int64_t juice_timer_ms_t;
+
+typedef struct juice_timer juice_timer_t;
+
+typedef void (*juice_timer_cb_t)(juice_timer_t *timer, juice_timer_ms_t now, void *user_ptr);
+
+struct juice_timer {
+    juice_timer_ms_t deadline;
+    juice_timer_ms_t slack;
+    juice_timer_cb_t cb;
+    void *user_ptr;
+    bool armed;
+    juice_timer_t *next;
+};
+
+typedef struct {
+    uint32_t wakeups;           // Calls to juice_timer_run() that fired at least one timer
+    uint32_t spurious_wakeups;  // Calls that fired nothing
+    uint32_t timers_fired;
+    juice_timer_ms_t since;     // Start of the measurement window
+} juice_timer_stats_t;
+
+typedef struct {
+    juice_timer_t *head;
+    juice_timer_ms_t granularity;
+    juice_timer_stats_t stats;
+} juice_timer_service_t;
+
+void juice_timer_service_init(juice_timer_service_t *service, juice_timer_ms_t granularity, juice_timer_ms_t now);
+
+void juice_timer_init(juice_timer_t *timer, juice_timer_cb_t cb, void *user_ptr);
+
+/**
+ * Arm (or re-arm) a timer, slack < 0 selects JUICE_TIMER_DEFAULT_SLACK_MS.
+ * Safe to call from a timer callback.
+ */
+void juice_timer_arm(juice_timer_service_t *service, juice_timer_t *timer,
+                     juice_timer_ms_t deadline, juice_timer_ms_t slack);
+
+void juice_timer_disarm(juice_timer_service_t *service, juice_timer_t *timer);
+
+/**
+ * Instant at which the conn loop should wake up next, or -1 if no timer is armed.
+ */
+juice_timer_ms_t juice_timer_next_wakeup(const juice_timer_service_t *service);
+
+/**
+ * Fire every timer whose deadline has passed, in one batch.
+ * Returns the number of timers fired.
+ */
+int juice_timer_run(juice_timer_service_t *service, juice_timer_ms_t now);
+
+/**
+ * Read the instrumentation counters and the average number of wakeups per
+ * 1000 s since the last reset. Resets the counters if reset is true.
+ */
+void juice_timer_get_stats(juice_timer_service_t *service, juice_timer_ms_t now, bool reset,
+                           juice_timer_stats_t *stats, uint32_t *wakeups_per_ksec);
+
+/*
+ * Hooks of the conn backends (esp-ice-libjuice-conn-timers.patch.txt).
+ *
+ * conn_poll and conn_mux arm the deadline of every agent in a service shared
+ * by their registry and sleep until juice_timer_next_wakeup(). conn_thread has
+ * one thread and so one timer per agent: nothing is coalesced there, the slack
+ * only aligns the wakeups of the threads on the grid. Only the deadlines of
+ * connected agents get slack. An interrupt re-arms the timer of its agent as
+ * due, without slack, so the loop it wakes fires it right away.
+ */
+
+void juice_conn_timer_set_coalescing(bool enabled);
+
+bool juice_conn_timer_is_coalescing(void);
+
+/**
+ * Arm the timer of an agent for its next bookkeeping deadline, with the default
+ * slack if coalescing is enabled, the agent connected and the deadline ahead of now.
+ */
+void juice_conn_timer_arm(juice_timer_service_t *service, juice_timer_t *timer, juice_timer_ms_t deadline,
+                          juice_state_t state, juice_timer_ms_t now);
+
+/**
+ * Timer callback of the conn backends, user_ptr points to the bool flagging
+ * the agent for an update.
+ */
+void juice_conn_timer_fired(juice_timer_t *timer, juice_timer_ms_t now, void *user_ptr);
+
+/**
+ * Count one wakeup of a conn loop, which fired that many timers (0 if it was
+ * woken by a datagram or an interrupt).
+ */
+void juice_conn_timer_account(juice_concurrency_mode_t mode, int fired);
+
+/**
+ * Wakeups of the conn loops of one concurrency mode: stats->wakeups counts the
+ * timer-driven ones and stats->spurious_wakeups all the others.
+ */
+void juice_conn_timer_get_stats(juice_concurrency_mode_t mode, bool reset, juice_timer_stats_t *stats);
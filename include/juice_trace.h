@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+
+/*
+ * Connection-establishment timeline.
+ *
+ * Trace points are recorded with a microsecond timestamp into a fixed-size
+ * ring (CONFIG_ESP_ICE_TRACE_EVENTS entries, oldest entries are overwritten).
+ * With CONFIG_ESP_ICE_TRACE disabled the macros compile to nothing.
+ */
+
+typedef enum {
+    JUICE_TRACE_AGENT_CREATE,
+    JUICE_TRACE_GATHER,             // juice_gather_candidates()
+    JUICE_TRACE_ADDR_RESOLVE,       // DNS resolution
+    JUICE_TRACE_SOCKET_SETUP,       // udp_create_socket()
+    JUICE_TRACE_LOCAL_CANDIDATE,    // arg: juice_trace_candidate_type_t
+    JUICE_TRACE_GATHERING_DONE,
+    JUICE_TRACE_REMOTE_DESCRIPTION,
+    JUICE_TRACE_REMOTE_CANDIDATE,
+    JUICE_TRACE_STUN_TRANSACTION,   // id: first bytes of the transaction ID, arg: STUN method (begin,
+                                    // retransmission) or response class (end)
+    JUICE_TRACE_STATE,              // arg: juice_state_t
+    JUICE_TRACE_NOMINATION,         // arg: index of the pair the agent nominated, or accepted as nominated
+    JUICE_TRACE_PAIR_STATE,         // arg: JUICE_TRACE_PAIR_ARG()
+    JUICE_TRACE_STAGE_COUNT
+} juice_trace_stage_t;
+
+typedef enum {
+    JUICE_TRACE_CANDIDATE_HOST,
+    JUICE_TRACE_CANDIDATE_SRFLX,
+    JUICE_TRACE_CANDIDATE_RELAY,
+    JUICE_TRACE_CANDIDATE_OTHER,
+} juice_trace_candidate_type_t;
+
+typedef enum {
+    JUICE_TRACE_PAIR_PENDING,
+    JUICE_TRACE_PAIR_SUCCEEDED,
+    JUICE_TRACE_PAIR_FAILED,
+    JUICE_TRACE_PAIR_FROZEN,
+} juice_trace_pair_state_t;
+
+// Candidate pair events carry the index of the pair in the agent, its nomination and its state
+#define JUICE_TRACE_PAIR_ARG(index, nominated, state) (((index) << 8) | ((nominated) ? 0x10 : 0) | (state))
+#define JUICE_TRACE_PAIR_INDEX(arg) ((arg) >> 8)
+#define JUICE_TRACE_PAIR_NOMINATED(arg) (((arg) & 0x10) != 0)
+#define JUICE_TRACE_PAIR_STATE_OF(arg) ((juice_trace_pair_state_t)((arg) & 0x0F))
+
+typedef struct {
+    int64_t timestamp;      // us, esp_timer_get_time()
+    uint32_t id;            // Matches begin and end of the same operation
+    int32_t arg;
+    uint8_t stage;          // juice_trace_stage_t
+    char phase;             // 'b' begin, 'e' end, 'n' instant
+} juice_trace_event_t;
+
+void juice_trace_record(juice_trace_stage_t stage, char phase, uint32_t id, int32_t arg);
+
+void juice_trace_reset(void);
+
+/**
+ * Copy up to count events, oldest first. Returns the number of events copied.
+ */
+size_t juice_trace_get_events(juice_trace_event_t *events, size_t count);
+
+const char *juice_trace_stage_to_string(juice_trace_stage_t stage);
+
+/**
+ * Write the ring as Chrome trace-event JSON, to be opened in chrome://tracing
+ * or Perfetto. Returns -1 on write error.
+ */
+int juice_trace_dump_chrome(FILE *out);
+
+/**
+ * Print the ring as one compact line per event, with the delay since the
+ * previous event, through the log.
+ */
+void juice_trace_dump_log(void);
+
+/**
+ * Chrome JSON on the Linux host target, compact log on the chip.
+ */
+int juice_trace_dump(FILE *out);
+
+#ifdef CONFIG_ESP_ICE_TRACE
+#define JUICE_TRACE_BEGIN(stage, id) juice_trace_record((stage), 'b', (id), 0)
+#define JUICE_TRACE_BEGIN_ARG(stage, id, arg) juice_trace_record((stage), 'b', (id), (arg))
+#define JUICE_TRACE_END(stage, id, arg) juice_trace_record((stage), 'e', (id), (arg))
+#define JUICE_TRACE_INSTANT(stage, id, arg) juice_trace_record((stage), 'n', (id), (arg))
+#else
+#define JUICE_TRACE_BEGIN(stage, id) do { } while (0)
+#define JUICE_TRACE_BEGIN_ARG(stage, id, arg) do { } while (0)
+#define JUICE_TRACE_END(stage, id, arg) do { } while (0)
+#define JUICE_TRACE_INSTANT(stage, id, arg) do { } while (0)
+#endif
@@ -33,6 +33,24 @@ int getnameinfo(const struct sockaddr *addr, socklen_t addrlen,
 
             break;
 
+        case AF_INET6: {
+            const struct sockaddr_in6 *sin6p = (const struct sockaddr_in6 *) addr;
+            if (flags & AI_NUMERICHOST) {
+                if (inet_ntop(AF_INET6, &sin6p->sin6_addr, host, hostlen) == NULL) {
+                    return EOVERFLOW;
+                }
+            }
+
+            if (flags & AI_NUMERICSERV) {
+                int port = ntohs(sin6p->sin6_port);
+                if (snprintf(serv, servlen, "%d", port) < 0) {
+                    return EOVERFLOW;
+                }
+            }
+
+            break;
+        }
+
         default:
             return EAI_FAMILY;  // Unsupported address family
     }
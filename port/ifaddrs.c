@@ -3,6 +3,38 @@
 #include "esp_netif.h"
 #include <stdlib.h>
 #include "ifaddrs.h"
+#include "juice_alloc.h"
+
+#if CONFIG_LWIP_IPV6
+// Append the IPv6 addresses of the interface, link-local ones are not usable as host candidates
+static void append_ip6_addrs(esp_netif_t *netif, struct ifaddrs *ifaddr)
+{
+    esp_ip6_addr_t ip6[CONFIG_LWIP_IPV6_NUM_ADDRESSES];
+    int count = esp_netif_get_all_ip6(netif, ip6);
+    for (int i = 0; i < count; ++i) {
+        if (esp_netif_ip6_get_addr_type(&ip6[i]) == ESP_IP6_ADDR_IS_LINK_LOCAL) {
+            continue;
+        }
+        struct ifaddrs *entry = (struct ifaddrs *)juice_calloc(1, sizeof(struct ifaddrs));
+        struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)juice_calloc(1, sizeof(struct sockaddr_in6));
+        char *name = juice_malloc(strlen(ifaddr->ifa_name) + 1);
+        if (entry == NULL || addr_in6 == NULL || name == NULL) {
+            juice_free(entry);
+            juice_free(addr_in6);
+            juice_free(name);
+            return;
+        }
+        strcpy(name, ifaddr->ifa_name);
+        addr_in6->sin6_family = AF_INET6;
+        memcpy(&addr_in6->sin6_addr, ip6[i].addr, sizeof(addr_in6->sin6_addr));
+        entry->ifa_name = name;
+        entry->ifa_addr = (struct sockaddr *)addr_in6;
+        entry->ifa_flags = IFF_UP;
+        entry->ifa_next = ifaddr->ifa_next;
+        ifaddr->ifa_next = entry;
+    }
+}
+#endif
 
 int getifaddrs(struct ifaddrs **ifap)
 {
@@ -11,23 +43,25 @@ int getifaddrs(struct ifaddrs **ifap)
     }
 
     // Allocate memory for a single ifaddrs structure
-    struct ifaddrs *ifaddr = (struct ifaddrs *)calloc(1, sizeof(struct ifaddrs));
+    struct ifaddrs *ifaddr = (struct ifaddrs *)juice_calloc(1, sizeof(struct ifaddrs));
     if (ifaddr == NULL) {
         return -1; // Memory allocation failure
     }
 
     // Allocate memory for the interface name
-    ifaddr->ifa_name = strdup("sta"); // Replace with actual interface name if known
+    static const char name[] = "sta"; // Replace with actual interface name if known
+    ifaddr->ifa_name = juice_malloc(sizeof(name));
     if (ifaddr->ifa_name == NULL) {
-        free(ifaddr);
+        juice_free(ifaddr);
         return -1;
     }
+    memcpy(ifaddr->ifa_name, name, sizeof(name));
 
     // Allocate memory for the sockaddr structure
-    struct sockaddr_in *addr_in = (struct sockaddr_in *)calloc(1, sizeof(struct sockaddr_in));
+    struct sockaddr_in *addr_in = (struct sockaddr_in *)juice_calloc(1, sizeof(struct sockaddr_in));
     if (addr_in == NULL) {
-        free(ifaddr->ifa_name);
-        free(ifaddr);
+        juice_free(ifaddr->ifa_name);
+        juice_free(ifaddr);
         return -1;
     }
 
@@ -35,14 +69,15 @@ int getifaddrs(struct ifaddrs **ifap)
     esp_netif_ip_info_t ip;
     esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
     if (netif == NULL) {
-        free(ifaddr->ifa_name);
-        free(ifaddr);
+        juice_free(addr_in);
+        juice_free(ifaddr->ifa_name);
+        juice_free(ifaddr);
         return -1;
     }
     if (esp_netif_get_ip_info(netif, &ip) != ESP_OK) {
-        free(addr_in);
-        free(ifaddr->ifa_name);
-        free(ifaddr);
+        juice_free(addr_in);
+        juice_free(ifaddr->ifa_name);
+        juice_free(ifaddr);
         return -1;
     }
 
@@ -53,6 +88,9 @@ int getifaddrs(struct ifaddrs **ifap)
     // Link the sockaddr to ifaddrs
     ifaddr->ifa_addr = (struct sockaddr *)addr_in;
     ifaddr->ifa_flags = IFF_UP; // Mark the interface as UP, add more flags as needed
+#if CONFIG_LWIP_IPV6
+    append_ip6_addrs(netif, ifaddr);
+#endif
 
     *ifap = ifaddr; // Return the linked list
     return 0; // Success
@@ -63,12 +101,12 @@ void freeifaddrs(struct ifaddrs *ifa)
     while (ifa != NULL) {
         struct ifaddrs *next = ifa->ifa_next;
         if (ifa->ifa_name) {
-            free(ifa->ifa_name);
+            juice_free(ifa->ifa_name);
         }
         if (ifa->ifa_addr) {
-            free(ifa->ifa_addr);
+            juice_free(ifa->ifa_addr);
         }
-        free(ifa);
+        juice_free(ifa);
         ifa = next;
     }
 }
@@ -0,0 +1,325 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "juice_alloc.h"
+
+#define ARENA_ALIGN 8
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+static const char *TAG = "juice_alloc";
+
+typedef struct free_block {
+    struct free_block *next;
+} free_block_t;
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *end;
+    size_t block_size;
+    size_t block_count;
+    size_t in_use;
+    size_t peak;
+    free_block_t *free_list;
+} arena_pool_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static juice_allocator_t s_allocator;
+static bool s_has_allocator = false;
+static arena_pool_t s_pools[JUICE_ARENA_MAX_POOLS];
+static size_t s_pools_count = 0;
+static juice_alloc_stats_t s_stats;
+
+static void account_alloc(void *ptr, size_t bytes)
+{
+    if (ptr == NULL) {
+        s_stats.failures++;
+        return;
+    }
+    s_stats.allocations++;
+    if (s_stats.allocations > s_stats.allocations_peak) {
+        s_stats.allocations_peak = s_stats.allocations;
+    }
+    s_stats.bytes_in_use += bytes;
+    if (s_stats.bytes_in_use > s_stats.bytes_peak) {
+        s_stats.bytes_peak = s_stats.bytes_in_use;
+    }
+}
+
+static arena_pool_t *pool_of(const void *ptr)
+{
+    for (size_t i = 0; i < s_pools_count; ++i) {
+        if ((const uint8_t *)ptr >= s_pools[i].start && (const uint8_t *)ptr < s_pools[i].end) {
+            return &s_pools[i];
+        }
+    }
+    return NULL;
+}
+
+static void *arena_alloc(size_t size)
+{
+    void *ptr = NULL;
+    size_t bytes = 0;
+    portENTER_CRITICAL(&s_lock);
+    for (size_t i = 0; i < s_pools_count; ++i) {
+        arena_pool_t *pool = &s_pools[i];
+        if (pool->block_size >= size && pool->free_list) {
+            ptr = pool->free_list;
+            pool->free_list = pool->free_list->next;
+            if (++pool->in_use > pool->peak) {
+                pool->peak = pool->in_use;
+            }
+            bytes = pool->block_size;
+            break;
+        }
+    }
+    account_alloc(ptr, bytes);
+    portEXIT_CRITICAL(&s_lock);
+    if (ptr == NULL) {
+        ESP_LOGE(TAG, "Arena exhausted, allocation of %u bytes failed", (unsigned)size);
+    }
+    return ptr;
+}
+
+static void arena_free(void *ptr)
+{
+    portENTER_CRITICAL(&s_lock);
+    arena_pool_t *pool = pool_of(ptr);
+    if (pool) {
+        free_block_t *block = ptr;
+        block->next = pool->free_list;
+        pool->free_list = block;
+        pool->in_use--;
+        s_stats.allocations--;
+        s_stats.bytes_in_use -= pool->block_size;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (pool == NULL) {
+        ESP_LOGE(TAG, "Freeing %p which does not belong to the arena", ptr);
+    }
+}
+
+// The allocator is copied under the lock, juice_set_allocator() may replace it concurrently
+static void get_mode(size_t *pools_count, bool *has_allocator, juice_allocator_t *allocator)
+{
+    portENTER_CRITICAL(&s_lock);
+    *pools_count = s_pools_count;
+    *has_allocator = s_has_allocator;
+    if (s_has_allocator) {
+        *allocator = s_allocator;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static void account_failure(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_stats.failures++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void *juice_malloc(size_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+    size_t pools_count;
+    bool has_allocator;
+    juice_allocator_t allocator;
+    get_mode(&pools_count, &has_allocator, &allocator);
+    if (pools_count) {
+        return arena_alloc(size);
+    }
+    void *ptr = has_allocator ? allocator.malloc(size, allocator.user_ptr) : malloc(size);
+    portENTER_CRITICAL(&s_lock);
+    account_alloc(ptr, 0);
+    portEXIT_CRITICAL(&s_lock);
+    return ptr;
+}
+
+void *juice_calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > SIZE_MAX / size) {
+        account_failure();
+        return NULL;
+    }
+    void *ptr = juice_malloc(nmemb * size);
+    if (ptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+void *juice_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return juice_malloc(size);
+    }
+    if (size == 0) {
+        juice_free(ptr);
+        return NULL;
+    }
+    size_t pools_count;
+    bool has_allocator;
+    juice_allocator_t allocator;
+    get_mode(&pools_count, &has_allocator, &allocator);
+    if (pools_count) {
+        portENTER_CRITICAL(&s_lock);
+        arena_pool_t *pool = pool_of(ptr);
+        size_t block_size = pool ? pool->block_size : 0;
+        portEXIT_CRITICAL(&s_lock);
+        if (pool == NULL) {
+            // Its size is unknown, the data cannot be moved
+            ESP_LOGE(TAG, "Reallocating %p which does not belong to the arena", ptr);
+            account_failure();
+            return NULL;
+        }
+        if (size <= block_size) {
+            return ptr;
+        }
+        void *new_ptr = arena_alloc(size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, block_size);
+            arena_free(ptr);
+        }
+        return new_ptr;
+    }
+    void *new_ptr = has_allocator ? allocator.realloc(ptr, size, allocator.user_ptr) : realloc(ptr, size);
+    if (new_ptr == NULL) {
+        account_failure();
+    }
+    return new_ptr;
+}
+
+void juice_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    size_t pools_count;
+    bool has_allocator;
+    juice_allocator_t allocator;
+    get_mode(&pools_count, &has_allocator, &allocator);
+    if (pools_count) {
+        arena_free(ptr);
+        return;
+    }
+    if (has_allocator) {
+        allocator.free(ptr, allocator.user_ptr);
+    } else {
+        free(ptr);
+    }
+    portENTER_CRITICAL(&s_lock);
+    s_stats.allocations--;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static bool has_live_allocations(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    size_t allocations = s_stats.allocations;
+    portEXIT_CRITICAL(&s_lock);
+    if (allocations) {
+        ESP_LOGE(TAG, "Cannot change the allocator with %u allocations alive", (unsigned)allocations);
+        return true;
+    }
+    return false;
+}
+
+int juice_set_allocator(const juice_allocator_t *alloc)
+{
+    if (has_live_allocations()) {
+        return -1;
+    }
+    if (alloc && (!alloc->malloc || !alloc->realloc || !alloc->free)) {
+        ESP_LOGE(TAG, "Incomplete allocator");
+        return -1;
+    }
+    portENTER_CRITICAL(&s_lock);
+    s_pools_count = 0;
+    s_has_allocator = alloc != NULL;
+    if (alloc) {
+        s_allocator = *alloc;
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_lock);
+    return 0;
+}
+
+int juice_set_static_arena(const juice_arena_config_t *config)
+{
+    if (has_live_allocations()) {
+        return -1;
+    }
+    if (config == NULL || config->buffer == NULL || config->pools_count == 0 ||
+            config->pools_count > JUICE_ARENA_MAX_POOLS) {
+        ESP_LOGE(TAG, "Invalid arena configuration");
+        return -1;
+    }
+    uint8_t *begin = (uint8_t *)ALIGN_UP((uintptr_t)config->buffer);
+    uint8_t *end = (uint8_t *)config->buffer + config->size;
+    if (end < begin) {
+        ESP_LOGE(TAG, "Arena buffer is too small");
+        return -1;
+    }
+    uint8_t *cur = begin;
+    arena_pool_t pools[JUICE_ARENA_MAX_POOLS];
+    for (size_t i = 0; i < config->pools_count; ++i) {
+        const juice_arena_pool_config_t *pc = &config->pools[i];
+        size_t block_size = ALIGN_UP(pc->block_size < sizeof(free_block_t) ? sizeof(free_block_t) : pc->block_size);
+        if (i > 0 && block_size < pools[i - 1].block_size) {
+            ESP_LOGE(TAG, "Arena pools must be sorted by block size");
+            return -1;
+        }
+        if (pc->block_count > (size_t)(end - cur) / block_size) {
+            ESP_LOGE(TAG, "Arena buffer of %u bytes is too small for pool %u", (unsigned)config->size, (unsigned)i);
+            return -1;
+        }
+        arena_pool_t *pool = &pools[i];
+        memset(pool, 0, sizeof(*pool));
+        pool->start = cur;
+        pool->block_size = block_size;
+        pool->block_count = pc->block_count;
+        for (size_t b = pc->block_count; b > 0; --b) {
+            free_block_t *block = (free_block_t *)(cur + (b - 1) * block_size);
+            block->next = pool->free_list;
+            pool->free_list = block;
+        }
+        cur += pc->block_count * block_size;
+        pool->end = cur;
+    }
+    ESP_LOGI(TAG, "Arena of %u pools uses %u of %u bytes", (unsigned)config->pools_count,
+             (unsigned)(cur - begin), (unsigned)config->size);
+
+    portENTER_CRITICAL(&s_lock);
+    memcpy(s_pools, pools, config->pools_count * sizeof(arena_pool_t));
+    s_pools_count = config->pools_count;
+    s_has_allocator = false;
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_lock);
+    return 0;
+}
+
+void juice_get_alloc_stats(juice_alloc_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int juice_get_arena_pool_stats(size_t index, juice_arena_pool_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (index >= s_pools_count) {
+        portEXIT_CRITICAL(&s_lock);
+        return -1;
+    }
+    stats->block_size = s_pools[index].block_size;
+    stats->block_count = s_pools[index].block_count;
+    stats->blocks_in_use = s_pools[index].in_use;
+    stats->blocks_peak = s_pools[index].peak;
+    portEXIT_CRITICAL(&s_lock);
+    return 0;
+}
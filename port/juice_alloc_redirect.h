@@ -0,0 +1,16 @@
+#pragma once
+
+/*
+ * Force-included in the libjuice sources when CONFIG_ESP_ICE_ALLOCATOR_HOOKS
+ * is set, so that their heap usage goes through juice_alloc.h without
+ * patching every call site. The C library declarations come first and are
+ * left untouched.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "juice_alloc.h"
+
+#define malloc(size) juice_malloc(size)
+#define calloc(nmemb, size) juice_calloc(nmemb, size)
+#define realloc(ptr, size) juice_realloc(ptr, size)
+#define free(ptr) juice_free(ptr)
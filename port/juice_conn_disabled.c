@@ -0,0 +1,191 @@
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+/*
+ * Backends of the concurrency modes compiled out by the build profile.
+ * conn.c refers to every mode in its dispatch table, so the disabled ones are
+ * replaced by these stubs, which fail the creation of the agent's connection.
+ */
+
+static const char *TAG = "juice_conn";
+
+#if !CONFIG_ESP_ICE_CONN_POLL
+#include "../libjuice/src/conn_poll.h"
+
+int conn_poll_registry_init(conn_registry_t *registry, udp_socket_config_t *config)
+{
+    (void)registry;
+    (void)config;
+    ESP_LOGE(TAG, "Poll concurrency mode is disabled, see CONFIG_ESP_ICE_CONN_POLL");
+    return -1;
+}
+
+void conn_poll_registry_cleanup(conn_registry_t *registry)
+{
+    (void)registry;
+}
+
+int conn_poll_init(juice_agent_t *agent, conn_registry_t *registry, udp_socket_config_t *config)
+{
+    (void)agent;
+    (void)registry;
+    (void)config;
+    return -1;
+}
+
+void conn_poll_cleanup(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_poll_lock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_poll_unlock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+int conn_poll_interrupt(juice_agent_t *agent)
+{
+    (void)agent;
+    return -1;
+}
+
+int conn_poll_send(juice_agent_t *agent, const addr_record_t *dst, const char *data, size_t size, int ds)
+{
+    (void)agent;
+    (void)dst;
+    (void)data;
+    (void)size;
+    (void)ds;
+    return -1;
+}
+
+int conn_poll_get_addrs(juice_agent_t *agent, addr_record_t *records, size_t size)
+{
+    (void)agent;
+    (void)records;
+    (void)size;
+    return -1;
+}
+#endif
+
+#if !CONFIG_ESP_ICE_CONN_MUX
+#include "../libjuice/src/conn_mux.h"
+
+int conn_mux_registry_init(conn_registry_t *registry, udp_socket_config_t *config)
+{
+    (void)registry;
+    (void)config;
+    ESP_LOGE(TAG, "Mux concurrency mode is disabled, see CONFIG_ESP_ICE_CONN_MUX");
+    return -1;
+}
+
+void conn_mux_registry_cleanup(conn_registry_t *registry)
+{
+    (void)registry;
+}
+
+int conn_mux_init(juice_agent_t *agent, conn_registry_t *registry, udp_socket_config_t *config)
+{
+    (void)agent;
+    (void)registry;
+    (void)config;
+    return -1;
+}
+
+void conn_mux_cleanup(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_mux_lock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_mux_unlock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+int conn_mux_interrupt(juice_agent_t *agent)
+{
+    (void)agent;
+    return -1;
+}
+
+int conn_mux_send(juice_agent_t *agent, const addr_record_t *dst, const char *data, size_t size, int ds)
+{
+    (void)agent;
+    (void)dst;
+    (void)data;
+    (void)size;
+    (void)ds;
+    return -1;
+}
+
+int conn_mux_get_addrs(juice_agent_t *agent, addr_record_t *records, size_t size)
+{
+    (void)agent;
+    (void)records;
+    (void)size;
+    return -1;
+}
+#endif
+
+#if !CONFIG_ESP_ICE_CONN_THREAD
+#include "../libjuice/src/conn_thread.h"
+
+// The thread mode has no registry, the agent's connection is created directly
+int conn_thread_init(juice_agent_t *agent, conn_registry_t *registry, udp_socket_config_t *config)
+{
+    (void)agent;
+    (void)registry;
+    (void)config;
+    ESP_LOGE(TAG, "Thread concurrency mode is disabled, see CONFIG_ESP_ICE_CONN_THREAD");
+    return -1;
+}
+
+void conn_thread_cleanup(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_thread_lock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+void conn_thread_unlock(juice_agent_t *agent)
+{
+    (void)agent;
+}
+
+int conn_thread_interrupt(juice_agent_t *agent)
+{
+    (void)agent;
+    return -1;
+}
+
+int conn_thread_send(juice_agent_t *agent, const addr_record_t *dst, const char *data, size_t size, int ds)
+{
+    (void)agent;
+    (void)dst;
+    (void)data;
+    (void)size;
+    (void)ds;
+    return -1;
+}
+
+int conn_thread_get_addrs(juice_agent_t *agent, addr_record_t *records, size_t size)
+{
+    (void)agent;
+    (void)records;
+    (void)size;
+    return -1;
+}
+#endif
@@ -0,0 +1,398 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "juice_alloc.h"
+#include "juice_dual_stack.h"
+
+static const char *TAG = "juice_dual_stack";
+
+struct juice_dual_stack {
+    juice_agent_t *agent;
+    juice_cb_state_changed_t cb_state_changed;
+    juice_cb_candidate_t cb_candidate;
+    juice_cb_gathering_done_t cb_gathering_done;
+    juice_cb_recv_t cb_recv;
+    void *user_ptr;
+    int head_start_ms;
+    esp_timer_handle_t timer;
+    portMUX_TYPE lock;
+    int64_t created_us;
+    int64_t first_ipv4_us;      // First remote IPv4 candidate held back, -1 if none yet
+    int64_t first_ipv6_us;      // First remote IPv6 candidate, -1 if none yet
+    bool released;              // Head start over, IPv4 candidates go straight to the agent
+    bool connected;
+    bool completed;             // Nominated, the held back candidates are no longer a fallback
+    bool failed;
+    bool remote_done;           // Remote gathering done, forwarded after the held back candidates
+    bool done_forwarded;
+    bool destroying;            // juice_dual_stack_destroy() started, the timer is no longer armed
+    int busy;                   // kick() and service() calls in progress
+    TaskHandle_t destroyer;     // Notified by the last of them once destroying
+    size_t deferred_count;
+    char deferred[JUICE_DUAL_STACK_MAX_DEFERRED][JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+    juice_dual_stack_stats_t stats;
+};
+
+// Family of the address of an SDP candidate line, 0 for hostnames which are resolved by the agent
+static int candidate_family(const char *sdp)
+{
+    const char *p = strstr(sdp, "candidate:");
+    char address[JUICE_MAX_ADDRESS_STRING_LEN];
+    if (p == NULL || sscanf(p, "candidate:%*s %*s %*s %*s %63s", address) != 1) {
+        return 0;
+    }
+    uint8_t buf[16];
+    if (inet_pton(AF_INET6, address, buf) == 1) {
+        return AF_INET6;
+    }
+    if (inet_pton(AF_INET, address, buf) == 1) {
+        return AF_INET;
+    }
+    return 0;
+}
+
+// Family of "address:port" or "[address]:port" as written by juice_get_selected_addresses()
+static int address_family(const char *address)
+{
+    const char *colon = strchr(address, ':');
+    return colon && strchr(colon + 1, ':') ? AF_INET6 : AF_INET;
+}
+
+// Counts a user of the timer and of the agent, false once the context is being destroyed
+static bool enter(juice_dual_stack_t *ds)
+{
+    portENTER_CRITICAL(&ds->lock);
+    bool ok = !ds->destroying;
+    if (ok) {
+        ++ds->busy;
+    }
+    portEXIT_CRITICAL(&ds->lock);
+    return ok;
+}
+
+static void leave(juice_dual_stack_t *ds)
+{
+    portENTER_CRITICAL(&ds->lock);
+    TaskHandle_t destroyer = --ds->busy == 0 ? ds->destroyer : NULL;
+    portEXIT_CRITICAL(&ds->lock);
+    // The context may be freed as soon as the destroyer runs, only its task is touched here
+    if (destroyer) {
+        xTaskNotifyGive(destroyer);
+    }
+}
+
+static void kick(juice_dual_stack_t *ds, int64_t delay_us)
+{
+    if (!enter(ds)) {
+        return;
+    }
+    // If the timer was already pending, the service re-arms it anyway
+    esp_timer_stop(ds->timer);
+    esp_timer_start_once(ds->timer, delay_us > 0 ? delay_us : 1);
+    leave(ds);
+}
+
+// Runs on the esp_timer task: releases or drops the held back candidates and forwards the end of gathering.
+// Connected is not enough to drop them: until the pair is nominated they are the fallback of a failing IPv6 path.
+static void service(void *arg)
+{
+    juice_dual_stack_t *ds = arg;
+    if (!enter(ds)) {
+        return;
+    }
+    portENTER_CRITICAL(&ds->lock);
+    bool selected = ds->connected && ds->stats.family == 0;
+    portEXIT_CRITICAL(&ds->lock);
+    int family = 0;
+    if (selected) {
+        char local[JUICE_MAX_ADDRESS_STRING_LEN];
+        char remote[JUICE_MAX_ADDRESS_STRING_LEN];
+        if (juice_get_selected_addresses(ds->agent, local, sizeof(local), remote, sizeof(remote)) == 0) {
+            family = address_family(remote);
+        }
+    }
+
+    bool flush = false;
+    bool done = false;
+    int64_t wait_us = 0;
+    portENTER_CRITICAL(&ds->lock);
+    if (family) {
+        ds->stats.family = family;
+    }
+    if (!ds->released && ds->deferred_count > 0) {
+        int64_t release_us = ds->first_ipv6_us >= 0 ? ds->first_ipv6_us + ds->head_start_ms * 1000LL :
+                             ds->first_ipv4_us + JUICE_DUAL_STACK_RESOLUTION_DELAY_MS * 1000LL;
+        int64_t now = esp_timer_get_time();
+        if (ds->completed) {
+            ds->released = true;
+            ds->stats.dropped += ds->deferred_count;
+            ds->deferred_count = 0;
+        } else if (ds->failed || now >= release_us || (ds->remote_done && ds->first_ipv6_us < 0)) {
+            ds->released = true;
+            flush = true;
+        } else {
+            wait_us = release_us - now;
+        }
+    }
+    if (ds->remote_done && !ds->done_forwarded && (ds->released || ds->deferred_count == 0)) {
+        ds->done_forwarded = true;
+        done = true;
+    }
+    portEXIT_CRITICAL(&ds->lock);
+
+    // Nothing is appended once released, the list is stable without the lock
+    if (flush) {
+        ESP_LOGD(TAG, "Adding %u held back IPv4 candidates", (unsigned)ds->deferred_count);
+        for (size_t i = 0; i < ds->deferred_count; ++i) {
+            juice_add_remote_candidate(ds->agent, ds->deferred[i]);
+        }
+    }
+    if (done) {
+        juice_set_remote_gathering_done(ds->agent);
+    }
+    if (wait_us > 0) {
+        kick(ds, wait_us);
+    }
+    leave(ds);
+}
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    juice_dual_stack_t *ds = user_ptr;
+    if (state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED || state == JUICE_STATE_FAILED) {
+        portENTER_CRITICAL(&ds->lock);
+        if (state == JUICE_STATE_FAILED) {
+            ds->failed = true;
+        } else if (!ds->connected) {
+            ds->connected = true;
+            ds->stats.connected_ms = (esp_timer_get_time() - ds->created_us) / 1000;
+        }
+        if (state == JUICE_STATE_COMPLETED) {
+            ds->completed = true;
+        }
+        portEXIT_CRITICAL(&ds->lock);
+        kick(ds, 0);
+    }
+    if (ds->cb_state_changed) {
+        ds->cb_state_changed(agent, state, ds->user_ptr);
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    juice_dual_stack_t *ds = user_ptr;
+    if (ds->cb_candidate) {
+        ds->cb_candidate(agent, sdp, ds->user_ptr);
+    }
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    juice_dual_stack_t *ds = user_ptr;
+    if (ds->cb_gathering_done) {
+        ds->cb_gathering_done(agent, ds->user_ptr);
+    }
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr)
+{
+    juice_dual_stack_t *ds = user_ptr;
+    if (ds->cb_recv) {
+        ds->cb_recv(agent, data, size, ds->user_ptr);
+    }
+}
+
+juice_dual_stack_t *juice_dual_stack_create(const juice_config_t *config, const juice_dual_stack_config_t *ds_config)
+{
+    juice_dual_stack_t *ds = juice_calloc(1, sizeof(*ds));
+    if (ds == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the dual-stack context");
+        return NULL;
+    }
+    ds->head_start_ms = ds_config && ds_config->head_start_ms ? ds_config->head_start_ms :
+                        JUICE_DUAL_STACK_DEFAULT_HEAD_START_MS;
+    ds->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    ds->created_us = esp_timer_get_time();
+    ds->first_ipv4_us = -1;
+    ds->first_ipv6_us = -1;
+    ds->stats.connected_ms = -1;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = service,
+        .arg = ds,
+        .name = "juice_ds",
+    };
+    if (esp_timer_create(&timer_args, &ds->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the head start timer");
+        juice_free(ds);
+        return NULL;
+    }
+
+    juice_config_t wrapped = *config;
+    ds->cb_state_changed = config->cb_state_changed;
+    ds->cb_candidate = config->cb_candidate;
+    ds->cb_gathering_done = config->cb_gathering_done;
+    ds->cb_recv = config->cb_recv;
+    ds->user_ptr = config->user_ptr;
+    wrapped.cb_state_changed = on_state_changed;
+    wrapped.cb_candidate = on_candidate;
+    wrapped.cb_gathering_done = on_gathering_done;
+    wrapped.cb_recv = on_recv;
+    wrapped.user_ptr = ds;
+    wrapped.dual_stack = true;
+    ds->agent = juice_create(&wrapped);
+    if (ds->agent == NULL) {
+        esp_timer_delete(ds->timer);
+        juice_free(ds);
+        return NULL;
+    }
+    return ds;
+}
+
+void juice_dual_stack_destroy(juice_dual_stack_t *ds)
+{
+    if (ds == NULL) {
+        return;
+    }
+    // No kick() or service() starts past this point, the last one in progress notifies this task once
+    portENTER_CRITICAL(&ds->lock);
+    ds->destroying = true;
+    bool wait = ds->busy > 0;
+    if (wait) {
+        ds->destroyer = xTaskGetCurrentTaskHandle();
+    }
+    portEXIT_CRITICAL(&ds->lock);
+    esp_timer_stop(ds->timer);
+    if (wait) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    // A kick() in progress may have armed it again
+    esp_timer_stop(ds->timer);
+    esp_timer_delete(ds->timer);
+    // The agent goes last: its callbacks may still run until juice_destroy() returns, they find the
+    // context destroying and leave the timer alone
+    juice_destroy(ds->agent);
+    juice_free(ds);
+}
+
+juice_agent_t *juice_dual_stack_get_agent(juice_dual_stack_t *ds)
+{
+    return ds->agent;
+}
+
+int juice_dual_stack_add_remote_candidate(juice_dual_stack_t *ds, const char *sdp)
+{
+    int family = candidate_family(sdp);
+    int64_t now = esp_timer_get_time();
+    bool deferred = false;
+    portENTER_CRITICAL(&ds->lock);
+    if (family == AF_INET6 && ds->first_ipv6_us < 0) {
+        ds->first_ipv6_us = now;
+    }
+    // A full list or an oversized line is not paced, but still added
+    if (family == AF_INET && ds->head_start_ms > 0 && !ds->released &&
+            ds->deferred_count < JUICE_DUAL_STACK_MAX_DEFERRED && strlen(sdp) < JUICE_MAX_CANDIDATE_SDP_STRING_LEN) {
+        if (ds->first_ipv4_us < 0) {
+            ds->first_ipv4_us = now;
+        }
+        strcpy(ds->deferred[ds->deferred_count++], sdp);
+        ds->stats.deferred++;
+        deferred = true;
+    }
+    portEXIT_CRITICAL(&ds->lock);
+
+    if (deferred || family == AF_INET6) {
+        kick(ds, 0);
+    }
+    return deferred ? 0 : juice_add_remote_candidate(ds->agent, sdp);
+}
+
+int juice_dual_stack_set_remote_description(juice_dual_stack_t *ds, const char *sdp)
+{
+    if (ds->head_start_ms < 0) {
+        return juice_set_remote_description(ds->agent, sdp);
+    }
+    // Candidate and end-of-candidates lines are replayed through the wrapper once the description is set
+    size_t size = strlen(sdp) + 1;
+    char *filtered = juice_malloc(size);
+    if (filtered == NULL) {
+        return -1;
+    }
+    char *out = filtered;
+    bool end_of_candidates = false;
+    for (const char *line = sdp; *line;) {
+        const char *eol = strchr(line, '\n');
+        size_t len = eol ? (size_t)(eol - line + 1) : strlen(line);
+        int family = strncmp(line, "a=candidate:", 12) == 0 ? candidate_family(line) : 0;
+        if (strncmp(line, "a=end-of-candidates", 19) == 0) {
+            end_of_candidates = true;
+        } else if (family != AF_INET) {
+            if (family == AF_INET6) {
+                portENTER_CRITICAL(&ds->lock);
+                if (ds->first_ipv6_us < 0) {
+                    ds->first_ipv6_us = esp_timer_get_time();
+                }
+                portEXIT_CRITICAL(&ds->lock);
+            }
+            memcpy(out, line, len);
+            out += len;
+        }
+        line += len;
+    }
+    *out = '\0';
+    int ret = juice_set_remote_description(ds->agent, filtered);
+    juice_free(filtered);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (const char *line = sdp; *line;) {
+        const char *eol = strchr(line, '\n');
+        size_t next = eol ? (size_t)(eol - line + 1) : strlen(line);
+        if (strncmp(line, "a=candidate:", 12) == 0 && candidate_family(line) == AF_INET) {
+            char candidate[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+            size_t len = next;
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+                --len;
+            }
+            if (len < sizeof(candidate)) {
+                memcpy(candidate, line, len);
+                candidate[len] = '\0';
+                juice_dual_stack_add_remote_candidate(ds, candidate);
+            }
+        }
+        line += next;
+    }
+    return end_of_candidates ? juice_dual_stack_set_remote_gathering_done(ds) : 0;
+}
+
+int juice_dual_stack_set_remote_gathering_done(juice_dual_stack_t *ds)
+{
+    bool forward = false;
+    portENTER_CRITICAL(&ds->lock);
+    ds->remote_done = true;
+    if (ds->released || ds->deferred_count == 0) {
+        ds->done_forwarded = true;
+        forward = true;
+    }
+    portEXIT_CRITICAL(&ds->lock);
+    if (forward) {
+        return juice_set_remote_gathering_done(ds->agent);
+    }
+    // Without any IPv6 candidate, the held back ones are released at once
+    kick(ds, 0);
+    return 0;
+}
+
+void juice_dual_stack_get_stats(juice_dual_stack_t *ds, juice_dual_stack_stats_t *stats)
+{
+    portENTER_CRITICAL(&ds->lock);
+    *stats = ds->stats;
+    portEXIT_CRITICAL(&ds->lock);
+}
@@ -0,0 +1,19 @@
+#include "sdkconfig.h"
+#include "juice/juice.h"
+
+/*
+ * Link-time checks for the public API of subsystems compiled out by the build
+ * profile. References to their entry points are redirected here with
+ * -Wl,--wrap: this object is only pulled from the archive when the application
+ * uses them, and then fails the link on a symbol naming the option to enable.
+ */
+
+#if !CONFIG_ESP_ICE_SERVER
+juice_server_t *esp_ice_server_is_disabled__enable_CONFIG_ESP_ICE_SERVER(void);
+
+juice_server_t *__wrap_juice_server_create(const juice_server_config_t *config)
+{
+    (void)config;
+    return esp_ice_server_is_disabled__enable_CONFIG_ESP_ICE_SERVER();
+}
+#endif
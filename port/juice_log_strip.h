@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Force-included into the libjuice sources when CONFIG_ESP_ICE_LOG_MIN_LEVEL
+ * is above verbose. It takes the include guard of libjuice's log.h, so that
+ * the JLOG_* macros below replace the upstream ones: messages under the
+ * configured level are folded away with their format strings, while their
+ * arguments still count as used.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "juice/juice.h"
+
+#define JUICE_LOG_H
+
+bool juice_log_is_enabled(juice_log_level_t level);
+void juice_log_write(juice_log_level_t level, const char *file, int line, const char *fmt, ...);
+
+#define JLOG_WRITE(level, ...) \
+    ((level) >= CONFIG_ESP_ICE_LOG_MIN_LEVEL ? juice_log_write(level, __FILE__, __LINE__, __VA_ARGS__) : (void)0)
+
+#define JLOG_ENABLED(level) ((level) >= CONFIG_ESP_ICE_LOG_MIN_LEVEL && juice_log_is_enabled(level))
+
+#define JLOG_VERBOSE(...) JLOG_WRITE(JUICE_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define JLOG_DEBUG(...) JLOG_WRITE(JUICE_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define JLOG_INFO(...) JLOG_WRITE(JUICE_LOG_LEVEL_INFO, __VA_ARGS__)
+#define JLOG_WARN(...) JLOG_WRITE(JUICE_LOG_LEVEL_WARN, __VA_ARGS__)
+#define JLOG_ERROR(...) JLOG_WRITE(JUICE_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define JLOG_FATAL(...) JLOG_WRITE(JUICE_LOG_LEVEL_FATAL, __VA_ARGS__)
+
+#define JLOG_VERBOSE_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_VERBOSE)
+#define JLOG_DEBUG_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_DEBUG)
+#define JLOG_INFO_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_INFO)
+#define JLOG_WARN_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_WARN)
+#define JLOG_ERROR_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_ERROR)
+#define JLOG_FATAL_ENABLED JLOG_ENABLED(JUICE_LOG_LEVEL_FATAL)
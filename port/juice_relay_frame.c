@@ -0,0 +1,148 @@
+#include <string.h>
+#include <netinet/in.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "juice_relay_frame.h"
+
+#define STUN_HEADER_SIZE 20
+#define STUN_MAGIC 0x2112A442
+#define STUN_SEND_INDICATION 0x0016
+#define STUN_ATTR_XOR_PEER_ADDRESS 0x0012
+#define STUN_ATTR_DATA 0x0013
+#define STUN_ATTR_FINGERPRINT 0x8028
+#define STUN_FINGERPRINT_XOR 0x5354554e
+
+static const char *TAG = "juice_relay";
+
+static inline void write16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline void write32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+int juice_sendbuf_init(juice_sendbuf_t *sb, void *storage, size_t capacity)
+{
+    if (storage == NULL || capacity < JUICE_SEND_HEADROOM + JUICE_SEND_TAILROOM) {
+        ESP_LOGE(TAG, "Send buffer too small, %u bytes", (unsigned)capacity);
+        return -1;
+    }
+    sb->storage = storage;
+    sb->capacity = capacity;
+    sb->len = 0;
+    return 0;
+}
+
+int juice_sendbuf_set_len(juice_sendbuf_t *sb, size_t len)
+{
+    if (len > juice_sendbuf_payload_capacity(sb) || len > JUICE_SEND_MAX_PAYLOAD) {
+        ESP_LOGE(TAG, "Payload of %u bytes does not fit", (unsigned)len);
+        return -1;
+    }
+    sb->len = len;
+    return 0;
+}
+
+int juice_frame_channel_data(juice_sendbuf_t *sb, uint16_t channel,
+                             const uint8_t **frame, size_t *frame_len)
+{
+    if (channel < 0x4000 || channel > 0x4FFF) {
+        ESP_LOGW(TAG, "Invalid channel number: 0x%hX", channel);
+        return -1;
+    }
+    uint8_t *begin = juice_sendbuf_payload(sb) - JUICE_CHANNEL_DATA_HEADROOM;
+    write16(begin, channel);
+    write16(begin + 2, (uint16_t)sb->len);
+    *frame = begin;
+    *frame_len = JUICE_CHANNEL_DATA_HEADROOM + sb->len;
+    return 0;
+}
+
+// Returns the attribute value length, written right before end
+static int write_xor_peer_address(uint8_t *end, const struct sockaddr *peer, const uint8_t *transaction_id)
+{
+    uint8_t mask[16];
+    write32(mask, STUN_MAGIC);
+    memcpy(mask + 4, transaction_id, 12);
+
+    if (peer->sa_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)peer;
+        uint8_t *value = end - 8;
+        const uint8_t *addr = (const uint8_t *)&sin->sin_addr;
+        value[0] = 0;
+        value[1] = 0x01;
+        write16(value + 2, ntohs(sin->sin_port) ^ (STUN_MAGIC >> 16));
+        for (int i = 0; i < 4; ++i) {
+            value[4 + i] = addr[i] ^ mask[i];
+        }
+        return 8;
+    }
+    if (peer->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)peer;
+        uint8_t *value = end - 20;
+        const uint8_t *addr = (const uint8_t *)&sin6->sin6_addr;
+        value[0] = 0;
+        value[1] = 0x02;
+        write16(value + 2, ntohs(sin6->sin6_port) ^ (STUN_MAGIC >> 16));
+        for (int i = 0; i < 16; ++i) {
+            value[4 + i] = addr[i] ^ mask[i];
+        }
+        return 20;
+    }
+    ESP_LOGW(TAG, "Unknown address family %hu", peer->sa_family);
+    return -1;
+}
+
+int juice_frame_send_indication(juice_sendbuf_t *sb, const struct sockaddr *peer,
+                                const uint8_t *transaction_id, bool fingerprint,
+                                const uint8_t **frame, size_t *frame_len)
+{
+    if (sb->len > JUICE_SEND_MAX_PAYLOAD) {
+        ESP_LOGE(TAG, "Payload of %u bytes too large for a Send indication", (unsigned)sb->len);
+        return -1;
+    }
+    uint8_t *payload = juice_sendbuf_payload(sb);
+
+    // Attributes are written backwards from the payload: DATA header, then XOR-PEER-ADDRESS
+    uint8_t *data_attr = payload - 4;
+    write16(data_attr, STUN_ATTR_DATA);
+    write16(data_attr + 2, (uint16_t)sb->len);
+
+    int addr_len = write_xor_peer_address(data_attr, peer, transaction_id);
+    if (addr_len < 0) {
+        return -1;
+    }
+    uint8_t *addr_attr = data_attr - addr_len - 4;
+    write16(addr_attr, STUN_ATTR_XOR_PEER_ADDRESS);
+    write16(addr_attr + 2, (uint16_t)addr_len);
+
+    uint8_t *begin = addr_attr - STUN_HEADER_SIZE;
+    uint8_t *end = payload + sb->len;
+    size_t padding = (4 - (sb->len & 3)) & 3;
+    memset(end, 0, padding);
+    end += padding;
+
+    size_t length = (end - begin) - STUN_HEADER_SIZE + (fingerprint ? 8 : 0);
+    write16(begin, STUN_SEND_INDICATION);
+    write16(begin + 2, (uint16_t)length);
+    write32(begin + 4, STUN_MAGIC);
+    memcpy(begin + 8, transaction_id, 12);
+
+    if (fingerprint) {
+        uint32_t crc = esp_rom_crc32_le(0, begin, end - begin) ^ STUN_FINGERPRINT_XOR;
+        write16(end, STUN_ATTR_FINGERPRINT);
+        write16(end + 2, 4);
+        write32(end + 4, crc);
+        end += 8;
+    }
+    *frame = begin;
+    *frame_len = end - begin;
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_rom_crc.h"
+#include "juice_stun_fast.h"
+
+#define STUN_FINGERPRINT_XOR 0x5354554e
+#define STUN_FINGERPRINT_LEN 4
+
+static const uint16_t s_attr_types[JUICE_STUN_ATTR_COUNT] = {
+    [JUICE_STUN_ATTR_MAPPED_ADDRESS] = 0x0001,
+    [JUICE_STUN_ATTR_XOR_MAPPED_ADDRESS] = 0x0020,
+    [JUICE_STUN_ATTR_USERNAME] = 0x0006,
+    [JUICE_STUN_ATTR_MESSAGE_INTEGRITY] = 0x0008,
+    [JUICE_STUN_ATTR_MESSAGE_INTEGRITY_SHA256] = 0x001C,
+    [JUICE_STUN_ATTR_FINGERPRINT] = 0x8028,
+    [JUICE_STUN_ATTR_ERROR_CODE] = 0x0009,
+    [JUICE_STUN_ATTR_PRIORITY] = 0x0024,
+    [JUICE_STUN_ATTR_USE_CANDIDATE] = 0x0025,
+    [JUICE_STUN_ATTR_ICE_CONTROLLED] = 0x8029,
+    [JUICE_STUN_ATTR_ICE_CONTROLLING] = 0x802A,
+    [JUICE_STUN_ATTR_CHANNEL_NUMBER] = 0x000C,
+    [JUICE_STUN_ATTR_XOR_PEER_ADDRESS] = 0x0012,
+    [JUICE_STUN_ATTR_XOR_RELAYED_ADDRESS] = 0x0016,
+    [JUICE_STUN_ATTR_DATA] = 0x0013,
+    [JUICE_STUN_ATTR_LIFETIME] = 0x000D,
+};
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static juice_stun_fast_stats_t s_stats;
+static volatile bool s_enabled = true;
+
+static inline uint16_t read16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static juice_pkt_class_t classify_stun(const uint8_t *p, size_t size, juice_stun_header_t *stun)
+{
+    uint16_t length = read16(p + 2);
+    // Over UDP the message is the whole datagram, and attributes are 4-byte aligned
+    if ((length & 0x03) || (size_t)length + JUICE_STUN_HEADER_SIZE != size) {
+        return JUICE_PKT_INVALID;
+    }
+    if (stun) {
+        uint16_t type = read16(p);
+        stun->msg_class = (juice_stun_class_t)(type & 0x0110);
+        stun->method = (type & 0x000F) | ((type & 0x00E0) >> 1) | ((type & 0x3E00) >> 2);
+        stun->length = length;
+        stun->transaction_id = p + 8;
+    }
+    return JUICE_PKT_STUN;
+}
+
+static juice_pkt_class_t classify_channel_data(const uint8_t *p, size_t size, juice_channel_data_header_t *chan)
+{
+    if (size < JUICE_CHANNEL_DATA_HEADER_SIZE) {
+        return JUICE_PKT_INVALID;
+    }
+    uint16_t length = read16(p + 2);
+    // Padding to 4 bytes is optional over UDP, anything beyond it is garbage
+    size_t padded = ((size_t)length + 3) & ~(size_t)3;
+    if (size < JUICE_CHANNEL_DATA_HEADER_SIZE + (size_t)length ||
+            size > JUICE_CHANNEL_DATA_HEADER_SIZE + padded) {
+        return JUICE_PKT_INVALID;
+    }
+    if (chan) {
+        chan->channel = read16(p);
+        chan->length = length;
+        chan->payload = p + JUICE_CHANNEL_DATA_HEADER_SIZE;
+    }
+    return JUICE_PKT_CHANNEL_DATA;
+}
+
+juice_pkt_class_t juice_pkt_classify(const void *data, size_t size, bool from_relay,
+                                     juice_stun_header_t *stun,
+                                     juice_channel_data_header_t *chan)
+{
+    if (data == NULL || size == 0) {
+        return JUICE_PKT_INVALID;
+    }
+    const uint8_t *p = data;
+    // RFC 7983: [0..3] STUN, [64..79] TURN channel (0x4000-0x4FFF), but the first byte alone is not enough:
+    // application payloads may start with the same values, only the magic cookie or the source tells them apart
+    if (p[0] < 4 && size >= JUICE_STUN_HEADER_SIZE && read32(p + 4) == JUICE_STUN_MAGIC) {
+        return classify_stun(p, size, stun);
+    }
+    if (from_relay && p[0] >= 64 && p[0] <= 79) {
+        return classify_channel_data(p, size, chan);
+    }
+    return JUICE_PKT_APP;
+}
+
+bool juice_stun_fast_accept(const juice_stun_header_t *stun,
+                            juice_stun_txn_lookup_t lookup, void *user_ptr)
+{
+    if (stun->msg_class == JUICE_STUN_CLASS_REQUEST || stun->msg_class == JUICE_STUN_CLASS_INDICATION) {
+        return true;
+    }
+    return lookup == NULL || lookup(stun->transaction_id, user_ptr);
+}
+
+juice_pkt_class_t juice_stun_fast_demux(const void *data, size_t size,
+                                        juice_stun_txn_lookup_t lookup, void *user_ptr)
+{
+    juice_stun_header_t stun;
+    juice_stun_fast_msg_t msg;
+    juice_pkt_class_t cls = juice_pkt_classify(data, size, false, &stun, NULL);
+    // Only the FINGERPRINT is located here, stun_read() decodes the rest once the message passed
+    if (cls == JUICE_PKT_STUN && (!juice_stun_fast_accept(&stun, lookup, user_ptr) ||
+                                  juice_stun_fast_parse(data, size, JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_FINGERPRINT), &msg) ||
+                                  !juice_stun_fast_check_fingerprint(data, &msg))) {
+        cls = JUICE_PKT_INVALID;
+    }
+    portENTER_CRITICAL(&s_lock);
+    switch (cls) {
+    case JUICE_PKT_APP:
+        s_stats.app++;
+        break;
+    case JUICE_PKT_STUN:
+        s_stats.stun++;
+        break;
+    default:
+        s_stats.dropped++;
+        break;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return cls;
+}
+
+void juice_stun_fast_set_enabled(bool enabled)
+{
+    s_enabled = enabled;
+}
+
+bool juice_stun_fast_is_enabled(void)
+{
+    return s_enabled;
+}
+
+void juice_stun_fast_get_stats(juice_stun_fast_stats_t *stats, bool reset)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    if (reset) {
+        memset(&s_stats, 0, sizeof(s_stats));
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static int attr_id_from_type(uint16_t type, uint32_t wanted_mask)
+{
+    for (uint32_t mask = wanted_mask; mask; mask &= mask - 1) {
+        int id = __builtin_ctz(mask);
+        if (s_attr_types[id] == type) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+int juice_stun_fast_parse(const void *data, size_t size, uint32_t wanted_mask,
+                          juice_stun_fast_msg_t *msg)
+{
+    const uint8_t *p = data;
+    wanted_mask &= JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_COUNT) - 1;
+    msg->found = 0;
+    memset(msg->attrs, 0, sizeof(msg->attrs));
+
+    if (size < JUICE_STUN_HEADER_SIZE) {
+        return -1;
+    }
+    size_t end = JUICE_STUN_HEADER_SIZE + read16(p + 2);
+    if (end > size) {
+        return -1;
+    }
+    bool has_integrity = false;
+    bool has_fingerprint = false;
+    size_t pos = JUICE_STUN_HEADER_SIZE;
+    while (pos < end) {
+        if (end - pos < 4 || has_fingerprint) {
+            return -1;
+        }
+        uint16_t type = read16(p + pos);
+        uint16_t length = read16(p + pos + 2);
+        size_t padded = ((size_t)length + 3) & ~(size_t)3;
+        if (end - pos - 4 < padded) {
+            return -1;
+        }
+        if (type == s_attr_types[JUICE_STUN_ATTR_FINGERPRINT]) {
+            if (length != STUN_FINGERPRINT_LEN) {
+                return -1;
+            }
+            has_fingerprint = true;
+        } else if (type == s_attr_types[JUICE_STUN_ATTR_MESSAGE_INTEGRITY]) {
+            has_integrity = true;
+        } else if (has_integrity && type != s_attr_types[JUICE_STUN_ATTR_MESSAGE_INTEGRITY_SHA256]) {
+            return -1;
+        }
+
+        int id = attr_id_from_type(type, wanted_mask & ~msg->found);
+        if (id >= 0) {
+            msg->attrs[id].value = p + pos + 4;
+            msg->attrs[id].length = length;
+            msg->attrs[id].offset = (uint16_t)pos;
+            msg->found |= JUICE_STUN_ATTR_BIT(id);
+        }
+        pos += 4 + padded;
+    }
+    return 0;
+}
+
+bool juice_stun_fast_check_fingerprint(const void *data, const juice_stun_fast_msg_t *msg)
+{
+    if (!(msg->found & JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_FINGERPRINT))) {
+        return true;
+    }
+    const juice_stun_attr_view_t *fp = &msg->attrs[JUICE_STUN_ATTR_FINGERPRINT];
+    // FINGERPRINT is the last attribute, so the header length already covers it
+    uint32_t expected = esp_rom_crc32_le(0, data, fp->offset) ^ STUN_FINGERPRINT_XOR;
+    return read32(fp->value) == expected;
+}
@@ -0,0 +1,233 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "juice_alloc.h"
+#include "juice_stun_race.h"
+
+#define LOOKUP_TASK_STACK 3072
+#define LOOKUP_TASK_PRIORITY 5
+
+static const char *TAG = "juice_stun_race";
+
+typedef struct {
+    juice_stun_gather_t *gather;
+    const char *host;
+    uint16_t port;
+} lookup_t;
+
+struct juice_stun_gather {
+    portMUX_TYPE lock;
+    SemaphoreHandle_t cb_lock;      // Held while a result is handed to the agent
+    juice_stun_gather_cb_t cb;
+    void *user_ptr;
+    int min_responses;
+    int refs;                       // Owner and running lookup tasks
+    size_t count;
+    size_t added;                   // Lookups whose entries were added or which failed
+    bool started;
+    bool launched;                  // juice_stun_gather_start() returned
+    bool stopped;
+    lookup_t lookups[JUICE_STUN_RACE_MAX_SERVERS];
+    char names[];                   // Copies of the host names
+};
+
+static void release(juice_stun_gather_t *gather)
+{
+    portENTER_CRITICAL(&gather->lock);
+    bool last = --gather->refs == 0;
+    portEXIT_CRITICAL(&gather->lock);
+    if (last) {
+        vSemaphoreDelete(gather->cb_lock);
+        juice_free(gather);
+    }
+}
+
+static bool is_numeric(const char *host)
+{
+    uint8_t buf[16];
+    return inet_pton(AF_INET, host, buf) == 1 || inet_pton(AF_INET6, host, buf) == 1;
+}
+
+static void resolve(lookup_t *lookup)
+{
+    juice_stun_gather_t *gather = lookup->gather;
+    struct sockaddr_storage records[JUICE_STUN_RACE_MAX_RECORDS];
+    socklen_t lens[JUICE_STUN_RACE_MAX_RECORDS];
+    size_t count = 0;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%hu", lookup->port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    struct addrinfo *ai_list = NULL;
+    if (getaddrinfo(lookup->host, service, &hints, &ai_list) == 0) {
+        // The first address of each family, the agent queries each from the matching base
+        for (struct addrinfo *ai = ai_list; ai && count < JUICE_STUN_RACE_MAX_RECORDS; ai = ai->ai_next) {
+            bool seen = false;
+            for (size_t i = 0; i < count; ++i) {
+                seen |= records[i].ss_family == ai->ai_family;
+            }
+            if (seen || (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) ||
+                    ai->ai_addrlen > sizeof(records[0])) {
+                continue;
+            }
+            memcpy(&records[count], ai->ai_addr, ai->ai_addrlen);
+            lens[count] = ai->ai_addrlen;
+            ++count;
+        }
+        freeaddrinfo(ai_list);
+    }
+    if (count == 0) {
+        ESP_LOGW(TAG, "Failed to resolve STUN server %s:%hu", lookup->host, lookup->port);
+    }
+
+    int index = lookup - gather->lookups;
+    xSemaphoreTake(gather->cb_lock, portMAX_DELAY);
+    if (!juice_stun_gather_is_stopped(gather)) {
+        gather->cb(index, records, lens, count, gather->user_ptr);
+    } else {
+        juice_stun_gather_mark_added(gather);
+    }
+    xSemaphoreGive(gather->cb_lock);
+}
+
+static void lookup_task(void *arg)
+{
+    lookup_t *lookup = arg;
+    resolve(lookup);
+    release(lookup->gather);
+    vTaskDelete(NULL);
+}
+
+juice_stun_gather_t *juice_stun_gather_create(const juice_stun_server_t *servers, size_t count,
+                                              int min_responses)
+{
+    if (count > JUICE_STUN_RACE_MAX_SERVERS) {
+        ESP_LOGW(TAG, "Only the first %d of %u STUN servers are raced", JUICE_STUN_RACE_MAX_SERVERS,
+                 (unsigned)count);
+        count = JUICE_STUN_RACE_MAX_SERVERS;
+    }
+    size_t names_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        names_size += strlen(servers[i].host) + 1;
+    }
+    juice_stun_gather_t *gather = juice_calloc(1, sizeof(*gather) + names_size);
+    if (gather == NULL) {
+        return NULL;
+    }
+    gather->cb_lock = xSemaphoreCreateMutex();
+    if (gather->cb_lock == NULL) {
+        juice_free(gather);
+        return NULL;
+    }
+    gather->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    gather->min_responses = min_responses > 0 ? min_responses : 1;
+    gather->refs = 1;
+    gather->count = count;
+    char *name = gather->names;
+    for (size_t i = 0; i < count; ++i) {
+        size_t len = strlen(servers[i].host) + 1;
+        memcpy(name, servers[i].host, len);
+        gather->lookups[i].gather = gather;
+        gather->lookups[i].host = name;
+        gather->lookups[i].port = servers[i].port;
+        name += len;
+    }
+    return gather;
+}
+
+int juice_stun_gather_start(juice_stun_gather_t *gather, juice_stun_gather_cb_t cb, void *user_ptr)
+{
+    portENTER_CRITICAL(&gather->lock);
+    bool started = gather->started;
+    gather->started = true;
+    portEXIT_CRITICAL(&gather->lock);
+    if (started) {
+        return -1;
+    }
+    gather->cb = cb;
+    gather->user_ptr = user_ptr;
+
+    // Names first, so that their lookups overlap with the numeric servers being added
+    for (size_t i = 0; i < gather->count; ++i) {
+        lookup_t *lookup = &gather->lookups[i];
+        if (is_numeric(lookup->host)) {
+            continue;
+        }
+        portENTER_CRITICAL(&gather->lock);
+        ++gather->refs;
+        portEXIT_CRITICAL(&gather->lock);
+        if (xTaskCreate(lookup_task, "juice_stun_dns", LOOKUP_TASK_STACK, lookup, LOOKUP_TASK_PRIORITY,
+                        NULL) != pdPASS) {
+            ESP_LOGW(TAG, "No lookup task for %s, resolving in place", lookup->host);
+            release(gather);
+            resolve(lookup);
+        }
+    }
+    for (size_t i = 0; i < gather->count; ++i) {
+        if (is_numeric(gather->lookups[i].host)) {
+            resolve(&gather->lookups[i]);
+        }
+    }
+    portENTER_CRITICAL(&gather->lock);
+    gather->launched = true;
+    portEXIT_CRITICAL(&gather->lock);
+    return 0;
+}
+
+void juice_stun_gather_stop(juice_stun_gather_t *gather)
+{
+    portENTER_CRITICAL(&gather->lock);
+    gather->stopped = true;
+    portEXIT_CRITICAL(&gather->lock);
+}
+
+bool juice_stun_gather_is_stopped(juice_stun_gather_t *gather)
+{
+    portENTER_CRITICAL(&gather->lock);
+    bool stopped = gather->stopped;
+    portEXIT_CRITICAL(&gather->lock);
+    return stopped;
+}
+
+void juice_stun_gather_mark_added(juice_stun_gather_t *gather)
+{
+    portENTER_CRITICAL(&gather->lock);
+    ++gather->added;
+    portEXIT_CRITICAL(&gather->lock);
+}
+
+bool juice_stun_gather_pending(juice_stun_gather_t *gather)
+{
+    portENTER_CRITICAL(&gather->lock);
+    bool pending = !gather->stopped && (!gather->launched || gather->added < gather->count);
+    portEXIT_CRITICAL(&gather->lock);
+    return pending;
+}
+
+int juice_stun_gather_min_responses(const juice_stun_gather_t *gather)
+{
+    return gather->min_responses;
+}
+
+void juice_stun_gather_destroy(juice_stun_gather_t *gather)
+{
+    if (gather == NULL) {
+        return;
+    }
+    // Once the lock is taken, no callback is running and none will run
+    xSemaphoreTake(gather->cb_lock, portMAX_DELAY);
+    juice_stun_gather_stop(gather);
+    xSemaphoreGive(gather->cb_lock);
+    release(gather);
+}
@@ -0,0 +1,188 @@
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "juice_timer.h"
+
+#define CONN_MODES_COUNT (JUICE_CONCURRENCY_MODE_THREAD + 1)
+
+static portMUX_TYPE s_conn_lock = portMUX_INITIALIZER_UNLOCKED;
+static juice_timer_stats_t s_conn_stats[CONN_MODES_COUNT];
+static bool s_coalescing = true;
+
+void juice_timer_service_init(juice_timer_service_t *service, juice_timer_ms_t granularity, juice_timer_ms_t now)
+{
+    service->head = NULL;
+    service->granularity = granularity > 0 ? granularity : JUICE_TIMER_DEFAULT_GRANULARITY_MS;
+    service->stats = (juice_timer_stats_t) {
+        .since = now,
+    };
+}
+
+void juice_timer_init(juice_timer_t *timer, juice_timer_cb_t cb, void *user_ptr)
+{
+    timer->deadline = 0;
+    timer->slack = 0;
+    timer->cb = cb;
+    timer->user_ptr = user_ptr;
+    timer->armed = false;
+    timer->next = NULL;
+}
+
+static void unlink_timer(juice_timer_service_t *service, juice_timer_t *timer)
+{
+    for (juice_timer_t **it = &service->head; *it; it = &(*it)->next) {
+        if (*it == timer) {
+            *it = timer->next;
+            break;
+        }
+    }
+    timer->next = NULL;
+    timer->armed = false;
+}
+
+void juice_timer_arm(juice_timer_service_t *service, juice_timer_t *timer,
+                     juice_timer_ms_t deadline, juice_timer_ms_t slack)
+{
+    if (timer->armed) {
+        unlink_timer(service, timer);
+    }
+    timer->deadline = deadline;
+    timer->slack = slack >= 0 ? slack : JUICE_TIMER_DEFAULT_SLACK_MS;
+    timer->armed = true;
+    timer->next = service->head;
+    service->head = timer;
+}
+
+void juice_timer_disarm(juice_timer_service_t *service, juice_timer_t *timer)
+{
+    if (timer->armed) {
+        unlink_timer(service, timer);
+    }
+}
+
+juice_timer_ms_t juice_timer_next_wakeup(const juice_timer_service_t *service)
+{
+    if (service->head == NULL) {
+        return -1;
+    }
+    // The latest instant satisfying every timer is the earliest end of window
+    const juice_timer_t *limiting = service->head;
+    for (const juice_timer_t *t = service->head->next; t; t = t->next) {
+        if (t->deadline + t->slack < limiting->deadline + limiting->slack) {
+            limiting = t;
+        }
+    }
+    juice_timer_ms_t latest = limiting->deadline + limiting->slack;
+    // Snap on the grid so that independent services end up waking together,
+    // as long as the limiting timer is still due at the aligned instant
+    juice_timer_ms_t aligned = latest - latest % service->granularity;
+    return aligned >= limiting->deadline ? aligned : latest;
+}
+
+int juice_timer_run(juice_timer_service_t *service, juice_timer_ms_t now)
+{
+    // Detach the whole batch first, callbacks are free to re-arm their timer
+    juice_timer_t *due = NULL;
+    juice_timer_t **it = &service->head;
+    while (*it) {
+        juice_timer_t *t = *it;
+        if (t->deadline <= now) {
+            *it = t->next;
+            t->armed = false;
+            t->next = due;
+            due = t;
+        } else {
+            it = &t->next;
+        }
+    }
+
+    int count = 0;
+    while (due) {
+        juice_timer_t *t = due;
+        due = t->next;
+        t->next = NULL;
+        t->cb(t, now, t->user_ptr);
+        ++count;
+    }
+
+    if (count) {
+        service->stats.wakeups++;
+        service->stats.timers_fired += count;
+    } else {
+        service->stats.spurious_wakeups++;
+    }
+    return count;
+}
+
+void juice_timer_get_stats(juice_timer_service_t *service, juice_timer_ms_t now, bool reset,
+                           juice_timer_stats_t *stats, uint32_t *wakeups_per_ksec)
+{
+    if (stats) {
+        *stats = service->stats;
+    }
+    if (wakeups_per_ksec) {
+        juice_timer_ms_t elapsed = now - service->stats.since;
+        uint64_t total = (uint64_t)service->stats.wakeups + service->stats.spurious_wakeups;
+        *wakeups_per_ksec = elapsed > 0 ? (uint32_t)(total * 1000000 / elapsed) : 0;
+    }
+    if (reset) {
+        service->stats = (juice_timer_stats_t) {
+            .since = now,
+        };
+    }
+}
+
+void juice_conn_timer_set_coalescing(bool enabled)
+{
+    s_coalescing = enabled;
+}
+
+bool juice_conn_timer_is_coalescing(void)
+{
+    return s_coalescing;
+}
+
+void juice_conn_timer_arm(juice_timer_service_t *service, juice_timer_t *timer, juice_timer_ms_t deadline,
+                          juice_state_t state, juice_timer_ms_t now)
+{
+    // Connectivity checks are paced by libjuice, only keepalives and refreshes may slip
+    bool idle = state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED;
+    juice_timer_arm(service, timer, deadline, s_coalescing && idle && deadline > now ? JUICE_TIMER_DEFAULT_SLACK_MS : 0);
+}
+
+void juice_conn_timer_fired(juice_timer_t *timer, juice_timer_ms_t now, void *user_ptr)
+{
+    *(bool *)user_ptr = true;
+}
+
+void juice_conn_timer_account(juice_concurrency_mode_t mode, int fired)
+{
+    if ((unsigned)mode >= CONN_MODES_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&s_conn_lock);
+    juice_timer_stats_t *stats = &s_conn_stats[mode];
+    if (fired) {
+        stats->wakeups++;
+        stats->timers_fired += fired;
+    } else {
+        stats->spurious_wakeups++;
+    }
+    portEXIT_CRITICAL(&s_conn_lock);
+}
+
+void juice_conn_timer_get_stats(juice_concurrency_mode_t mode, bool reset, juice_timer_stats_t *stats)
+{
+    if ((unsigned)mode >= CONN_MODES_COUNT) {
+        return;
+    }
+    juice_timer_ms_t now = esp_timer_get_time() / 1000;
+    portENTER_CRITICAL(&s_conn_lock);
+    *stats = s_conn_stats[mode];
+    if (reset) {
+        s_conn_stats[mode] = (juice_timer_stats_t) {
+            .since = now,
+        };
+    }
+    portEXIT_CRITICAL(&s_conn_lock);
+}
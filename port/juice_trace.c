@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "juice_trace.h"
+
+#define TRACE_EVENTS CONFIG_ESP_ICE_TRACE_EVENTS
+
+static const char *TAG = "juice_trace";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static juice_trace_event_t s_events[TRACE_EVENTS];
+static uint32_t s_next = 0;     // Total number of events recorded since the last reset
+
+static const char *const s_stage_names[JUICE_TRACE_STAGE_COUNT] = {
+    [JUICE_TRACE_AGENT_CREATE] = "agent_create",
+    [JUICE_TRACE_GATHER] = "gather_candidates",
+    [JUICE_TRACE_ADDR_RESOLVE] = "addr_resolve",
+    [JUICE_TRACE_SOCKET_SETUP] = "socket_setup",
+    [JUICE_TRACE_LOCAL_CANDIDATE] = "local_candidate",
+    [JUICE_TRACE_GATHERING_DONE] = "gathering_done",
+    [JUICE_TRACE_REMOTE_DESCRIPTION] = "remote_description",
+    [JUICE_TRACE_REMOTE_CANDIDATE] = "remote_candidate",
+    [JUICE_TRACE_STUN_TRANSACTION] = "stun_transaction",
+    [JUICE_TRACE_STATE] = "state",
+    [JUICE_TRACE_NOMINATION] = "nomination",
+    [JUICE_TRACE_PAIR_STATE] = "pair_state",
+};
+
+void juice_trace_record(juice_trace_stage_t stage, char phase, uint32_t id, int32_t arg)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    juice_trace_event_t *ev = &s_events[s_next % TRACE_EVENTS];
+    ev->timestamp = now;
+    ev->id = id;
+    ev->arg = arg;
+    ev->stage = (uint8_t)stage;
+    ev->phase = phase;
+    s_next++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void juice_trace_reset(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_next = 0;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t juice_trace_get_events(juice_trace_event_t *events, size_t count)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t available = s_next < TRACE_EVENTS ? s_next : TRACE_EVENTS;
+    uint32_t first = s_next - available;
+    if (count > available) {
+        count = available;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        events[i] = s_events[(first + i) % TRACE_EVENTS];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return count;
+}
+
+const char *juice_trace_stage_to_string(juice_trace_stage_t stage)
+{
+    return stage < JUICE_TRACE_STAGE_COUNT ? s_stage_names[stage] : "unknown";
+}
+
+// Dumps read the ring without holding the lock, so that printing does not
+// block the recording tasks: events recorded meanwhile may replace the oldest ones
+static uint32_t get_window(uint32_t *first)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t available = s_next < TRACE_EVENTS ? s_next : TRACE_EVENTS;
+    *first = s_next - available;
+    portEXIT_CRITICAL(&s_lock);
+    return available;
+}
+
+int juice_trace_dump_chrome(FILE *out)
+{
+    uint32_t first;
+    uint32_t count = get_window(&first);
+    if (fputs("{\"traceEvents\":[\n", out) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        const juice_trace_event_t *ev = &s_events[(first + i) % TRACE_EVENTS];
+        if (fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"ice\",\"ph\":\"%c\",\"ts\":%" PRId64
+                    ",\"pid\":1,\"tid\":1,\"id\":\"0x%08" PRIx32 "\",\"args\":{\"arg\":%" PRId32 "}}",
+                    i ? ",\n" : "", juice_trace_stage_to_string(ev->stage), ev->phase,
+                    ev->timestamp, ev->id, ev->arg) < 0) {
+            return -1;
+        }
+    }
+    if (fputs("\n]}\n", out) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void juice_trace_dump_log(void)
+{
+    uint32_t first;
+    uint32_t count = get_window(&first);
+    int64_t prev = -1;
+    for (uint32_t i = 0; i < count; ++i) {
+        const juice_trace_event_t *ev = &s_events[(first + i) % TRACE_EVENTS];
+        ESP_LOGI(TAG, "%10" PRId64 " us +%8" PRId64 " %-18s %c id=%08" PRIx32 " arg=%" PRId32,
+                 ev->timestamp, prev < 0 ? 0 : ev->timestamp - prev,
+                 juice_trace_stage_to_string(ev->stage), ev->phase, ev->id, ev->arg);
+        prev = ev->timestamp;
+    }
+}
+
+int juice_trace_dump(FILE *out)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return juice_trace_dump_chrome(out);
+#else
+    juice_trace_dump_log();
+    return 0;
+#endif
+}
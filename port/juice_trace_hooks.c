@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "juice/juice.h"
+#include "juice_stun_fast.h"
+#include "juice_trace.h"
+
+/*
+ * Trace points around libjuice, linked in with -Wl,--wrap. STUN transactions
+ * are observed on the datagrams crossing the conn backends, agent events by
+ * interposing the agent callbacks. DNS resolution, candidate pairs and
+ * nomination are traced inside libjuice (esp-ice-libjuice-trace.patch.txt).
+ */
+
+#define TRACED_AGENTS_MAX 8
+#define RECENT_REQUESTS 16
+
+typedef struct {
+    juice_agent_t *agent;
+    juice_cb_state_changed_t cb_state_changed;
+    juice_cb_candidate_t cb_candidate;
+    juice_cb_gathering_done_t cb_gathering_done;
+    juice_cb_recv_t cb_recv;
+    void *user_ptr;
+    bool used;
+} traced_agent_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static traced_agent_t s_agents[TRACED_AGENTS_MAX];
+static uint32_t s_recent_requests[RECENT_REQUESTS];
+static uint32_t s_recent_index = 0;
+static uint32_t s_seq = 0;
+
+static uint32_t next_seq(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t seq = ++s_seq;
+    portEXIT_CRITICAL(&s_lock);
+    return seq;
+}
+
+static inline uint32_t agent_id(const juice_agent_t *agent)
+{
+    return (uint32_t)(uintptr_t)agent;
+}
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    traced_agent_t *t = user_ptr;
+    JUICE_TRACE_INSTANT(JUICE_TRACE_STATE, agent_id(agent), state);
+    if (t->cb_state_changed) {
+        t->cb_state_changed(agent, state, t->user_ptr);
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    traced_agent_t *t = user_ptr;
+    juice_trace_candidate_type_t type = JUICE_TRACE_CANDIDATE_OTHER;
+    if (strstr(sdp, "typ host")) {
+        type = JUICE_TRACE_CANDIDATE_HOST;
+    } else if (strstr(sdp, "typ srflx")) {
+        type = JUICE_TRACE_CANDIDATE_SRFLX;
+    } else if (strstr(sdp, "typ relay")) {
+        type = JUICE_TRACE_CANDIDATE_RELAY;
+    }
+    JUICE_TRACE_INSTANT(JUICE_TRACE_LOCAL_CANDIDATE, agent_id(agent), type);
+    if (t->cb_candidate) {
+        t->cb_candidate(agent, sdp, t->user_ptr);
+    }
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    traced_agent_t *t = user_ptr;
+    JUICE_TRACE_INSTANT(JUICE_TRACE_GATHERING_DONE, agent_id(agent), 0);
+    if (t->cb_gathering_done) {
+        t->cb_gathering_done(agent, t->user_ptr);
+    }
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr)
+{
+    traced_agent_t *t = user_ptr;
+    if (t->cb_recv) {
+        t->cb_recv(agent, data, size, t->user_ptr);
+    }
+}
+
+juice_agent_t *__real_juice_create(const juice_config_t *config);
+
+juice_agent_t *__wrap_juice_create(const juice_config_t *config)
+{
+    uint32_t id = next_seq();
+    JUICE_TRACE_BEGIN(JUICE_TRACE_AGENT_CREATE, id);
+
+    traced_agent_t *t = NULL;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < TRACED_AGENTS_MAX; ++i) {
+        if (!s_agents[i].used) {
+            t = &s_agents[i];
+            t->used = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    juice_agent_t *agent;
+    if (t) {
+        juice_config_t traced = *config;
+        t->cb_state_changed = config->cb_state_changed;
+        t->cb_candidate = config->cb_candidate;
+        t->cb_gathering_done = config->cb_gathering_done;
+        t->cb_recv = config->cb_recv;
+        t->user_ptr = config->user_ptr;
+        traced.cb_state_changed = on_state_changed;
+        traced.cb_candidate = on_candidate;
+        traced.cb_gathering_done = on_gathering_done;
+        traced.cb_recv = on_recv;
+        traced.user_ptr = t;
+        agent = __real_juice_create(&traced);
+        t->agent = agent;
+        if (agent == NULL) {
+            t->used = false;
+        }
+    } else {
+        // Too many agents to interpose the callbacks, only the datagrams are traced
+        agent = __real_juice_create(config);
+    }
+
+    JUICE_TRACE_END(JUICE_TRACE_AGENT_CREATE, id, agent ? 0 : -1);
+    return agent;
+}
+
+void __real_juice_destroy(juice_agent_t *agent);
+
+void __wrap_juice_destroy(juice_agent_t *agent)
+{
+    __real_juice_destroy(agent);
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < TRACED_AGENTS_MAX; ++i) {
+        if (s_agents[i].used && s_agents[i].agent == agent) {
+            s_agents[i].used = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int __real_juice_gather_candidates(juice_agent_t *agent);
+
+int __wrap_juice_gather_candidates(juice_agent_t *agent)
+{
+    JUICE_TRACE_BEGIN(JUICE_TRACE_GATHER, agent_id(agent));
+    int ret = __real_juice_gather_candidates(agent);
+    JUICE_TRACE_END(JUICE_TRACE_GATHER, agent_id(agent), ret);
+    return ret;
+}
+
+int __real_juice_set_remote_description(juice_agent_t *agent, const char *sdp);
+
+int __wrap_juice_set_remote_description(juice_agent_t *agent, const char *sdp)
+{
+    JUICE_TRACE_INSTANT(JUICE_TRACE_REMOTE_DESCRIPTION, agent_id(agent), 0);
+    return __real_juice_set_remote_description(agent, sdp);
+}
+
+int __real_juice_add_remote_candidate(juice_agent_t *agent, const char *sdp);
+
+int __wrap_juice_add_remote_candidate(juice_agent_t *agent, const char *sdp)
+{
+    JUICE_TRACE_INSTANT(JUICE_TRACE_REMOTE_CANDIDATE, agent_id(agent), 0);
+    return __real_juice_add_remote_candidate(agent, sdp);
+}
+
+// udp_socket_config_t and addr_record_t are private to libjuice, only pointers cross here
+int __real_udp_create_socket(const void *config);
+
+int __wrap_udp_create_socket(const void *config)
+{
+    uint32_t id = next_seq();
+    JUICE_TRACE_BEGIN(JUICE_TRACE_SOCKET_SETUP, id);
+    int sock = __real_udp_create_socket(config);
+    JUICE_TRACE_END(JUICE_TRACE_SOCKET_SETUP, id, sock);
+    return sock;
+}
+
+static bool is_retransmission(uint32_t id)
+{
+    bool found = false;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < RECENT_REQUESTS; ++i) {
+        if (s_recent_requests[i] == id) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        s_recent_requests[s_recent_index++ % RECENT_REQUESTS] = id;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return found;
+}
+
+// Requests open a transaction and responses close it, whichever side sent them
+static void trace_datagram(const char *data, int size)
+{
+    juice_stun_header_t stun;
+    if (size <= 0 || juice_pkt_classify(data, size, false, &stun, NULL) != JUICE_PKT_STUN) {
+        return;
+    }
+    const uint8_t *tid = stun.transaction_id;
+    uint32_t id = ((uint32_t)tid[0] << 24) | ((uint32_t)tid[1] << 16) | ((uint32_t)tid[2] << 8) | tid[3];
+    switch (stun.msg_class) {
+    case JUICE_STUN_CLASS_REQUEST:
+        if (is_retransmission(id)) {
+            JUICE_TRACE_INSTANT(JUICE_TRACE_STUN_TRANSACTION, id, stun.method);
+        } else {
+            JUICE_TRACE_BEGIN_ARG(JUICE_TRACE_STUN_TRANSACTION, id, stun.method);
+        }
+        break;
+    case JUICE_STUN_CLASS_RESP_SUCCESS:
+    case JUICE_STUN_CLASS_RESP_ERROR:
+        JUICE_TRACE_END(JUICE_TRACE_STUN_TRANSACTION, id, stun.msg_class);
+        break;
+    default:
+        break;
+    }
+}
+
+int __real_juice_udp_sendto(int sock, const char *data, size_t size, const void *dst);
+
+int __wrap_juice_udp_sendto(int sock, const char *data, size_t size, const void *dst)
+{
+    trace_datagram(data, (int)size);
+    return __real_juice_udp_sendto(sock, data, size, dst);
+}
+
+int __real_udp_recvfrom(int sock, char *buffer, size_t size, void *src);
+
+int __wrap_udp_recvfrom(int sock, char *buffer, size_t size, void *src)
+{
+    int ret = __real_udp_recvfrom(sock, buffer, size, src);
+    trace_datagram(buffer, ret);
+    return ret;
+}
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# Builds test/connectivity with each build profile and prints the flash, IRAM
+# and static RAM footprint of the application and of the esp-ice component,
+# as a markdown table with one row per profile (bytes).
+# Usage: profiles/size_report.sh [target] [profile...]
+set -e
+
+target=${1:-esp32c3}
+shift || true
+profiles_dir=$(cd "$(dirname "$0")" && pwd)
+profiles=${*:-full client client_min}
+
+cd "${profiles_dir}/../test/connectivity"
+echo "| Profile (${target}) | Flash | IRAM | Static RAM | esp-ice flash | esp-ice IRAM | esp-ice static RAM |"
+echo "|---|---:|---:|---:|---:|---:|---:|"
+for profile in ${profiles}; do
+    build="build_${target}_${profile}"
+    args=(-B "${build}" -D SDKCONFIG="${build}/sdkconfig"
+          -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;${profiles_dir}/sdkconfig.${profile}")
+    idf.py "${args[@]}" set-target "${target}" > /dev/null
+    idf.py "${args[@]}" build > /dev/null
+    idf.py "${args[@]}" size --format json --output-file "${build}/size.json" > /dev/null
+    idf.py "${args[@]}" size-components --format json --output-file "${build}/size_components.json" > /dev/null
+    python3 - "${profile}" "${build}/size.json" "${build}/size_components.json" <<'EOF'
+import json
+import sys
+
+profile, image_file, components_file = sys.argv[1:]
+with open(image_file) as f:
+    image = json.load(f)
+with open(components_file) as f:
+    components = json.load(f)
+
+# Sections of an archive: flash_text/flash_rodata, iram (and diram), data/bss
+archive = next((v for k, v in components.items() if 'esp-ice' in k or 'esp_ice' in k), {})
+lib_flash = sum(v for k, v in archive.items() if k.startswith('flash'))
+lib_iram = sum(v for k, v in archive.items() if 'iram' in k)
+lib_ram = sum(v for k, v in archive.items() if k in ('data', 'bss', 'dram_data', 'dram_bss'))
+
+flash = image.get('used_flash_non_ram', image.get('flash_code', 0) + image.get('flash_rodata', 0))
+iram = image.get('used_iram', image.get('iram_text', 0) + image.get('iram_vectors', 0))
+ram = image.get('used_dram', image.get('dram_data', 0) + image.get('dram_bss', 0))
+print(f'| {profile} | {flash} | {iram} | {ram} | {lib_flash} | {lib_iram} | {lib_ram} |')
+EOF
+done
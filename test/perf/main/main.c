@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include "protocol_examples_common.h"
+#include "nvs_flash.h"
+#include "esp_event.h"
+#include "juice_trace.h"
+
+int test_stun_fast(void);
+int test_alloc(void);
+int test_timer(void);
+int test_relay_frame(void);
+int test_trace(void);
+int test_stun_race(void);
+int test_dual_stack(void);
+
+void app_main(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(example_connect());
+
+    printf("\nRunning trace test...\n");
+    if (test_trace()) {
+        printf("Trace test failed\n");
+        return;
+    }
+
+    printf("\nRunning STUN fast path test...\n");
+    if (test_stun_fast()) {
+        printf("STUN fast path test failed\n");
+        return;
+    }
+
+    printf("\nRunning coalesced timers benchmark...\n");
+    if (test_timer()) {
+        printf("Coalesced timers benchmark failed\n");
+        return;
+    }
+
+#if defined(CONFIG_ESP_ICE_TURN) && defined(CONFIG_ESP_ICE_SERVER)
+    // Relayed through a TURN allocation on the embedded server
+    printf("\nRunning zero-copy relay framing test...\n");
+    if (test_relay_frame()) {
+        printf("Zero-copy relay framing test failed\n");
+        return;
+    }
+#endif
+
+    printf("\nRunning parallel STUN servers test...\n");
+    if (test_stun_race()) {
+        printf("Parallel STUN servers test failed\n");
+        return;
+    }
+
+#ifdef CONFIG_LWIP_IPV6
+    printf("\nRunning dual-stack loopback test...\n");
+    if (test_dual_stack()) {
+        printf("Dual-stack loopback test failed\n");
+        return;
+    }
+#endif
+
+    printf("\nRunning static arena create/connect/destroy test...\n");
+    if (test_alloc()) {
+        printf("Static arena test failed\n");
+        return;
+    }
+#ifdef CONFIG_ESP_ICE_TRACE
+    // Timeline of the last create/connect/destroy cycles
+    juice_trace_dump(stdout);
+#endif
+    printf("Success\n");
+}
@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include "juice/juice.h"
+#include "juice_alloc.h"
+
+#define CYCLES 50
+#define CONNECT_TIMEOUT_MS 5000
+#define HEAP_GROWTH_TOLERANCE 256
+
+static const juice_arena_pool_config_t s_pools[] = {
+    { 64, 64 },
+    { 256, 32 },
+    { 1024, 16 },
+    { 4096, 4 },
+    { 24576, 2 },
+};
+
+static juice_agent_t *s_agents[2];
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    juice_add_remote_candidate(s_agents[(intptr_t)user_ptr], sdp);
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    juice_set_remote_gathering_done(s_agents[(intptr_t)user_ptr]);
+}
+
+static bool is_connected(juice_state_t state)
+{
+    return state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED;
+}
+
+static int connect_cycle(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        juice_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.cb_candidate = on_candidate;
+        config.cb_gathering_done = on_gathering_done;
+        config.user_ptr = (void *)(intptr_t)(1 - i);
+        s_agents[i] = juice_create(&config);
+        if (s_agents[i] == NULL) {
+            printf("Agent creation failed\n");
+            if (i == 1) {
+                juice_destroy(s_agents[0]);
+            }
+            return -1;
+        }
+    }
+
+    char sdp[JUICE_MAX_SDP_STRING_LEN];
+    juice_get_local_description(s_agents[0], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[1], sdp);
+    juice_get_local_description(s_agents[1], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[0], sdp);
+    juice_gather_candidates(s_agents[0]);
+    juice_gather_candidates(s_agents[1]);
+
+    int waited = 0;
+    while (!(is_connected(juice_get_state(s_agents[0])) && is_connected(juice_get_state(s_agents[1]))) &&
+            waited < CONNECT_TIMEOUT_MS) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+        waited += 50;
+    }
+    bool success = waited < CONNECT_TIMEOUT_MS;
+
+    juice_destroy(s_agents[0]);
+    juice_destroy(s_agents[1]);
+    if (!success) {
+        printf("Agents did not connect\n");
+        return -1;
+    }
+    return 0;
+}
+
+int test_alloc(void)
+{
+#if !CONFIG_ESP_ICE_ALLOCATOR_HOOKS
+    // libjuice allocations would bypass the arena, and every check below would pass on an empty one
+    printf("CONFIG_ESP_ICE_ALLOCATOR_HOOKS is disabled, skipping\n");
+    return 0;
+#else
+    size_t arena_size = 0;
+    for (size_t i = 0; i < sizeof(s_pools) / sizeof(s_pools[0]); ++i) {
+        arena_size += s_pools[i].block_size * s_pools[i].block_count;
+    }
+    void *arena = heap_caps_malloc(arena_size, MALLOC_CAP_8BIT);
+    if (arena == NULL) {
+        printf("Cannot allocate an arena of %u bytes\n", (unsigned)arena_size);
+        return -1;
+    }
+    juice_arena_config_t config = {
+        .buffer = arena,
+        .size = arena_size,
+        .pools = s_pools,
+        .pools_count = sizeof(s_pools) / sizeof(s_pools[0]),
+    };
+    if (juice_set_static_arena(&config)) {
+        heap_caps_free(arena);
+        return -1;
+    }
+
+    int ret = 0;
+    uint32_t baseline = 0;
+    juice_alloc_stats_t stats;
+    for (int cycle = 0; cycle < CYCLES; ++cycle) {
+        if (connect_cycle()) {
+            ret = -1;
+            break;
+        }
+        juice_get_alloc_stats(&stats);
+        if (stats.allocations != 0) {
+            printf("Cycle %d: %u allocations leaked in the arena\n", cycle, (unsigned)stats.allocations);
+            ret = -1;
+            break;
+        }
+        // The first cycle warms up the network stack, heap growth is measured from there
+        if (cycle == 0) {
+            baseline = esp_get_free_heap_size();
+        }
+    }
+
+    juice_get_alloc_stats(&stats);
+    uint32_t final = esp_get_free_heap_size();
+    printf("Arena: %u cycles, peak %u allocations, high-water %u of %u bytes, %u failures\n", CYCLES,
+           (unsigned)stats.allocations_peak, (unsigned)stats.bytes_peak, (unsigned)arena_size, (unsigned)stats.failures);
+    juice_arena_pool_stats_t pool;
+    for (size_t i = 0; juice_get_arena_pool_stats(i, &pool) == 0; ++i) {
+        printf("  pool %u: block %u bytes, peak %u of %u blocks\n", (unsigned)i, (unsigned)pool.block_size,
+               (unsigned)pool.blocks_peak, (unsigned)pool.block_count);
+    }
+    printf("Free heap: %u bytes after the first cycle, %u bytes after the last one\n",
+           (unsigned)baseline, (unsigned)final);
+    if (ret == 0 && stats.allocations_peak == 0) {
+        printf("No allocation went through the arena\n");
+        ret = -1;
+    }
+    if (ret == 0 && final + HEAP_GROWTH_TOLERANCE < baseline) {
+        printf("Heap grew by %u bytes\n", (unsigned)(baseline - final));
+        ret = -1;
+    }
+
+    // A block the arena does not own cannot be resized, its size is unknown
+    void *foreign = heap_caps_malloc(16, MALLOC_CAP_8BIT);
+    size_t failures = stats.failures;
+    if (foreign && juice_realloc(foreign, 32) != NULL) {
+        printf("Foreign block reallocated in the arena\n");
+        ret = -1;
+    }
+    juice_get_alloc_stats(&stats);
+    if (foreign && stats.failures != failures + 1) {
+        printf("Foreign reallocation not counted as a failure\n");
+        ret = -1;
+    }
+    heap_caps_free(foreign);
+
+    juice_set_allocator(NULL);
+    heap_caps_free(arena);
+    return ret;
+#endif
+}
@@ -0,0 +1,274 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "juice/juice.h"
+#include "juice_dual_stack.h"
+
+#define FAMILY_PORT 3490
+#define RACE_PORT 3494
+#define IDLE_PORT 3496
+#define DEAD_PORT 3499
+#define HEAD_START_MS 200
+#define TIMEOUT_MS 5000
+#define IDLE_MS 1000                // Long enough for the poll thread to block until the next keepalive
+
+typedef struct {
+    juice_agent_t *peer;            // Candidates are trickled to it, if set
+    volatile bool gathered;
+    volatile int64_t connected_us;
+    volatile int64_t recv_us;
+} side_t;
+
+static char s_sdp[JUICE_MAX_SDP_STRING_LEN];
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if ((state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED) && side->connected_us == 0) {
+        side->connected_us = esp_timer_get_time();
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if (side->peer) {
+        juice_add_remote_candidate(side->peer, sdp);
+    }
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    side->gathered = true;
+    if (side->peer) {
+        juice_set_remote_gathering_done(side->peer);
+    }
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    side->recv_us = esp_timer_get_time();
+}
+
+static void init_config(juice_config_t *config, const char *bind_address, uint16_t port, side_t *side)
+{
+    memset(config, 0, sizeof(*config));
+    config->bind_address = bind_address;
+    config->local_port_range_begin = port;
+    config->local_port_range_end = port;
+    config->cb_state_changed = on_state_changed;
+    config->cb_candidate = on_candidate;
+    config->cb_gathering_done = on_gathering_done;
+    config->cb_recv = on_recv;
+    config->user_ptr = side;
+}
+
+// Time from the start of gathering until both sides are connected, -1 on timeout
+static int wait_connected(const side_t *s1, const side_t *s2, int64_t start_us)
+{
+    while (s1->connected_us == 0 || s2->connected_us == 0) {
+        if (esp_timer_get_time() - start_us > TIMEOUT_MS * 1000LL) {
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    int64_t last = s1->connected_us > s2->connected_us ? s1->connected_us : s2->connected_us;
+    return (int)((last - start_us) / 1000);
+}
+
+static int selected_family(juice_agent_t *agent)
+{
+    char local[JUICE_MAX_ADDRESS_STRING_LEN];
+    char remote[JUICE_MAX_ADDRESS_STRING_LEN];
+    if (juice_get_selected_addresses(agent, local, sizeof(local), remote, sizeof(remote)) < 0) {
+        return 0;
+    }
+    const char *colon = strchr(remote, ':');
+    return colon && strchr(colon + 1, ':') ? AF_INET6 : AF_INET;
+}
+
+// Two agents bound to the loopback address of one family, trickling their candidates to each other
+static int connect_family(const char *loopback, int family, uint16_t port)
+{
+    static side_t s1, s2;
+    memset(&s1, 0, sizeof(s1));
+    memset(&s2, 0, sizeof(s2));
+    juice_config_t config;
+    init_config(&config, loopback, port, &s1);
+    juice_agent_t *agent1 = juice_create(&config);
+    init_config(&config, loopback, port + 1, &s2);
+    juice_agent_t *agent2 = juice_create(&config);
+    if (agent1 == NULL || agent2 == NULL) {
+        printf("%s: failed to create the agents\n", loopback);
+        juice_destroy(agent1);
+        juice_destroy(agent2);
+        return -1;
+    }
+    s1.peer = agent2;
+    s2.peer = agent1;
+    juice_get_local_description(agent1, s_sdp, sizeof(s_sdp));
+    juice_set_remote_description(agent2, s_sdp);
+    juice_get_local_description(agent2, s_sdp, sizeof(s_sdp));
+    juice_set_remote_description(agent1, s_sdp);
+
+    int64_t start = esp_timer_get_time();
+    juice_gather_candidates(agent1);
+    juice_gather_candidates(agent2);
+    int ms = wait_connected(&s1, &s2, start);
+    int selected = selected_family(agent1);
+    juice_destroy(agent1);
+    juice_destroy(agent2);
+
+    printf("time to connected over %s: %d ms\n", loopback, ms);
+    return ms >= 0 && selected == family ? 0 : -1;
+}
+
+static void add_loopback_candidates(juice_dual_stack_t *ds, uint16_t port, uint16_t ipv6_port)
+{
+    char candidate[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+    // IPv4 first, so that it also waits for the IPv6 one to show up
+    snprintf(candidate, sizeof(candidate), "a=candidate:2 1 UDP 2122317823 127.0.0.1 %hu typ host", port);
+    juice_dual_stack_add_remote_candidate(ds, candidate);
+    snprintf(candidate, sizeof(candidate), "a=candidate:1 1 UDP 2130706431 ::1 %hu typ host", ipv6_port);
+    juice_dual_stack_add_remote_candidate(ds, candidate);
+    juice_dual_stack_set_remote_gathering_done(ds);
+}
+
+// Two dual-stack agents offered both loopback addresses of each other, the IPv6 one dead or alive
+static int race(bool ipv6_alive, int *ms, juice_dual_stack_stats_t *stats)
+{
+    static side_t s1, s2;
+    memset(&s1, 0, sizeof(s1));
+    memset(&s2, 0, sizeof(s2));
+    memset(stats, 0, sizeof(*stats));
+    *ms = -1;
+    const juice_dual_stack_config_t ds_config = { .head_start_ms = HEAD_START_MS };
+    juice_config_t config;
+    init_config(&config, "::", RACE_PORT, &s1);
+    juice_dual_stack_t *ds1 = juice_dual_stack_create(&config, &ds_config);
+    init_config(&config, "::", RACE_PORT + 1, &s2);
+    juice_dual_stack_t *ds2 = juice_dual_stack_create(&config, &ds_config);
+    if (ds1 == NULL || ds2 == NULL) {
+        printf("race: failed to create the agents\n");
+        juice_dual_stack_destroy(ds1);
+        juice_dual_stack_destroy(ds2);
+        return -1;
+    }
+    juice_agent_t *agent1 = juice_dual_stack_get_agent(ds1);
+    juice_agent_t *agent2 = juice_dual_stack_get_agent(ds2);
+    juice_get_local_description(agent1, s_sdp, sizeof(s_sdp));
+    juice_dual_stack_set_remote_description(ds2, s_sdp);
+    juice_get_local_description(agent2, s_sdp, sizeof(s_sdp));
+    juice_dual_stack_set_remote_description(ds1, s_sdp);
+
+    // The gathered interface candidates are not exchanged, only the loopback ones
+    int64_t start = esp_timer_get_time();
+    juice_gather_candidates(agent1);
+    juice_gather_candidates(agent2);
+    while ((!s1.gathered || !s2.gathered) && esp_timer_get_time() - start < TIMEOUT_MS * 1000LL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    start = esp_timer_get_time();
+    add_loopback_candidates(ds1, RACE_PORT + 1, ipv6_alive ? RACE_PORT + 1 : DEAD_PORT);
+    add_loopback_candidates(ds2, RACE_PORT, ipv6_alive ? RACE_PORT : DEAD_PORT);
+
+    *ms = wait_connected(&s1, &s2, start);
+    vTaskDelay(pdMS_TO_TICKS(50));     // Let the wrappers record the selected pair
+    juice_dual_stack_get_stats(ds1, stats);
+    juice_dual_stack_destroy(ds1);
+    juice_dual_stack_destroy(ds2);
+    return *ms >= 0 ? 0 : -1;
+}
+
+// Connected dual-stack agents left idle: sending and destroying must wake the blocked poll thread
+static int send_and_destroy_idle(void)
+{
+    static side_t s1, s2;
+    memset(&s1, 0, sizeof(s1));
+    memset(&s2, 0, sizeof(s2));
+    juice_config_t config;
+    init_config(&config, "::", IDLE_PORT, &s1);
+    juice_dual_stack_t *ds1 = juice_dual_stack_create(&config, NULL);
+    init_config(&config, "::", IDLE_PORT + 1, &s2);
+    juice_dual_stack_t *ds2 = juice_dual_stack_create(&config, NULL);
+    if (ds1 == NULL || ds2 == NULL) {
+        printf("idle: failed to create the agents\n");
+        juice_dual_stack_destroy(ds1);
+        juice_dual_stack_destroy(ds2);
+        return -1;
+    }
+    juice_agent_t *agent1 = juice_dual_stack_get_agent(ds1);
+    juice_agent_t *agent2 = juice_dual_stack_get_agent(ds2);
+    juice_get_local_description(agent1, s_sdp, sizeof(s_sdp));
+    juice_dual_stack_set_remote_description(ds2, s_sdp);
+    juice_get_local_description(agent2, s_sdp, sizeof(s_sdp));
+    juice_dual_stack_set_remote_description(ds1, s_sdp);
+    juice_gather_candidates(agent1);
+    juice_gather_candidates(agent2);
+    add_loopback_candidates(ds1, IDLE_PORT + 1, IDLE_PORT + 1);
+    add_loopback_candidates(ds2, IDLE_PORT, IDLE_PORT);
+    int ret = wait_connected(&s1, &s2, esp_timer_get_time()) >= 0 ? 0 : -1;
+    if (ret != 0) {
+        printf("idle: the agents did not connect\n");
+    }
+
+    int send_ms = -1;
+    if (ret == 0) {
+        vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+        int64_t start = esp_timer_get_time();
+        juice_send(agent1, "idle", 4);
+        while (s2.recv_us == 0 && esp_timer_get_time() - start < TIMEOUT_MS * 1000LL) {
+            vTaskDelay(1);
+        }
+        send_ms = s2.recv_us ? (int)((s2.recv_us - start) / 1000) : -1;
+        vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+    }
+
+    int64_t start = esp_timer_get_time();
+    juice_dual_stack_destroy(ds1);
+    juice_dual_stack_destroy(ds2);
+    int destroy_ms = (esp_timer_get_time() - start) / 1000;
+    printf("idle: datagram received %d ms after juice_send(), both agents destroyed in %d ms\n", send_ms,
+           destroy_ms);
+    if (ret == 0 && (send_ms < 0 || send_ms > 100 || destroy_ms > 500)) {
+        printf("idle: the blocked poll thread was not woken up in time\n");
+        ret = -1;
+    }
+    return ret;
+}
+
+int test_dual_stack(void)
+{
+    int ret = 0;
+    ret |= connect_family("::1", AF_INET6, FAMILY_PORT);
+    ret |= connect_family("127.0.0.1", AF_INET, FAMILY_PORT + 2);
+
+    int ms;
+    juice_dual_stack_stats_t stats;
+    if (race(true, &ms, &stats) != 0 || stats.family != AF_INET6) {
+        printf("race with IPv6 up: IPv6 did not win (family=%d)\n", stats.family);
+        ret = -1;
+    } else {
+        printf("race with IPv6 up: IPv6 won in %d ms, %u IPv4 candidates held back, %u dropped\n", ms,
+               stats.deferred, stats.dropped);
+    }
+
+    // A broken IPv6 path only costs the head start
+    if (race(false, &ms, &stats) != 0 || stats.family != AF_INET || ms < HEAD_START_MS) {
+        printf("race with IPv6 down: IPv4 did not take over after the head start (family=%d, %d ms)\n",
+               stats.family, ms);
+        ret = -1;
+    } else {
+        printf("race with IPv6 down: IPv4 won in %d ms after a %d ms head start\n", ms, HEAD_START_MS);
+    }
+
+    ret |= send_and_destroy_idle();
+    return ret;
+}
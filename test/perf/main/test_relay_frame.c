@@ -0,0 +1,410 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "juice/juice.h"
+#include "juice_relay_frame.h"
+#include "juice_stun_fast.h"
+
+#define SERVER_PORT 3450
+#define RELAY_PORT_BEGIN 3452
+#define RELAY_PORT_END 3459
+#define AGENT_PORT 3448
+#define CONNECT_TIMEOUT_MS 10000
+#define CHANNEL_BIND_MS 500     // Let the first sends bind the channel before measuring
+#define BENCH_ROUNDS 1000
+#define BENCH_FRAMES 20000
+#define MAX_PAYLOAD 1200
+
+static const uint8_t s_txn[12] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+// Application payload of the round: text, starting with a byte of the STUN or ChannelData ranges every other round
+static void fill_payload(uint8_t *payload, size_t size, int round)
+{
+    static const uint8_t firsts[] = { 'H', 0x00, '@', 0x03 };
+    for (size_t i = 0; i < size; ++i) {
+        payload[i] = 'a' + (round + i) % 26;
+    }
+    payload[0] = firsts[round % sizeof(firsts)];
+}
+
+// Current path of juice_send(): the payload is copied behind the header into a new buffer, as turn_wrap_channel_data() does
+static size_t copy_channel_data(uint8_t *buffer, size_t size, const uint8_t *data, size_t data_size, uint16_t channel)
+{
+    if (data_size + 4 > size) {
+        return 0;
+    }
+    buffer[0] = channel >> 8;
+    buffer[1] = channel & 0xFF;
+    buffer[2] = data_size >> 8;
+    buffer[3] = data_size & 0xFF;
+    memcpy(buffer + 4, data, data_size);
+    return data_size + 4;
+}
+
+static int check_frames(const struct sockaddr_in *peer)
+{
+    static uint8_t storage[JUICE_SEND_HEADROOM + 64 + JUICE_SEND_TAILROOM];
+    juice_sendbuf_t sb;
+    const uint8_t *frame;
+    size_t frame_len;
+    juice_channel_data_header_t chan;
+
+    juice_sendbuf_init(&sb, storage, sizeof(storage));
+    memcpy(juice_sendbuf_payload(&sb), "hello relay", 11);
+    juice_sendbuf_set_len(&sb, 11);
+
+    if (juice_frame_channel_data(&sb, 0x4001, &frame, &frame_len) ||
+            juice_pkt_classify(frame, frame_len, true, NULL, &chan) != JUICE_PKT_CHANNEL_DATA ||
+            chan.channel != 0x4001 || chan.length != 11 || chan.payload != juice_sendbuf_payload(&sb)) {
+        printf("ChannelData framing failed\n");
+        return -1;
+    }
+
+    juice_stun_header_t stun;
+    juice_stun_fast_msg_t msg;
+    uint32_t wanted = JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_DATA) |
+                      JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_XOR_PEER_ADDRESS) |
+                      JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_FINGERPRINT);
+    if (juice_frame_send_indication(&sb, (const struct sockaddr *)peer, s_txn, true, &frame, &frame_len) ||
+            juice_pkt_classify(frame, frame_len, true, &stun, NULL) != JUICE_PKT_STUN ||
+            stun.msg_class != JUICE_STUN_CLASS_INDICATION || stun.method != 0x006 ||
+            juice_stun_fast_parse(frame, frame_len, wanted, &msg) || msg.found != wanted ||
+            msg.attrs[JUICE_STUN_ATTR_DATA].value != juice_sendbuf_payload(&sb) ||
+            msg.attrs[JUICE_STUN_ATTR_DATA].length != 11 ||
+            !juice_stun_fast_check_fingerprint(frame, &msg)) {
+        printf("Send indication framing failed\n");
+        return -1;
+    }
+
+    // The STUN length of the Send indication is 16 bits, a larger payload must not wrap it
+    static uint8_t large[JUICE_SEND_HEADROOM + JUICE_SEND_MAX_PAYLOAD + 1 + JUICE_SEND_TAILROOM];
+    juice_sendbuf_init(&sb, large, sizeof(large));
+    if (juice_sendbuf_set_len(&sb, JUICE_SEND_MAX_PAYLOAD + 1) == 0) {
+        printf("Payload overflowing the STUN length accepted\n");
+        return -1;
+    }
+    if (juice_sendbuf_set_len(&sb, JUICE_SEND_MAX_PAYLOAD) ||
+            juice_frame_send_indication(&sb, (const struct sockaddr *)peer, s_txn, true, &frame, &frame_len) ||
+            juice_pkt_classify(frame, frame_len, true, NULL, NULL) != JUICE_PKT_STUN) {
+        printf("Largest Send indication rejected\n");
+        return -1;
+    }
+    sb.len = JUICE_SEND_MAX_PAYLOAD + 1;
+    if (juice_frame_send_indication(&sb, (const struct sockaddr *)peer, s_txn, true, &frame, &frame_len) == 0) {
+        printf("Send indication with an overflowing length framed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Memory traffic of the framing alone: the copying path writes the header and
+ * the whole payload again into a new buffer for every send, the in-place paths
+ * only write the bytes around the payload.
+ */
+static void bench_framing(size_t payload_size, const struct sockaddr_in *peer)
+{
+    static uint8_t app[MAX_PAYLOAD];
+    static uint8_t wrapped[MAX_PAYLOAD + 4];
+    static uint8_t storage[JUICE_SEND_HEADROOM + MAX_PAYLOAD + JUICE_SEND_TAILROOM];
+    volatile uint8_t sink = 0;
+    const uint8_t *frame;
+    size_t frame_len = 0;
+    juice_sendbuf_t sb;
+    juice_sendbuf_init(&sb, storage, sizeof(storage));
+    fill_payload(app, payload_size, 0);
+    fill_payload(juice_sendbuf_payload(&sb), payload_size, 0);
+    juice_sendbuf_set_len(&sb, payload_size);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; ++i) {
+        app[1] = (uint8_t)i; // The application produces the payload in its own buffer
+        size_t len = copy_channel_data(wrapped, sizeof(wrapped), app, payload_size, 0x4001);
+        sink ^= wrapped[len - 1];
+    }
+    int64_t copy_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; ++i) {
+        juice_sendbuf_payload(&sb)[1] = (uint8_t)i; // The application produces the payload in place
+        juice_frame_channel_data(&sb, 0x4001, &frame, &frame_len);
+        sink ^= frame[frame_len - 1];
+    }
+    int64_t channel_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; ++i) {
+        juice_sendbuf_payload(&sb)[1] = (uint8_t)i;
+        juice_frame_send_indication(&sb, (const struct sockaddr *)peer, s_txn, true, &frame, &frame_len);
+        sink ^= frame[frame_len - 1];
+    }
+    int64_t indication_us = esp_timer_get_time() - start;
+
+    // Bytes written per send besides the payload produced by the application
+    unsigned indication_bytes = (unsigned)(frame_len - payload_size);
+    uint64_t bytes = (uint64_t)BENCH_FRAMES * payload_size;
+    printf("%4u bytes payload, %d frames:\n", (unsigned)payload_size, BENCH_FRAMES);
+    printf("  copy + ChannelData      : %7" PRId64 " us, %6" PRIu64 " kB/s, %4u bytes copied per send\n",
+           copy_us, copy_us ? bytes * 1000 / copy_us : 0, (unsigned)(payload_size + 4));
+    printf("  in-place ChannelData    : %7" PRId64 " us, %6" PRIu64 " kB/s, %4u bytes copied per send\n",
+           channel_us, channel_us ? bytes * 1000 / channel_us : 0, 4u);
+    printf("  in-place Send indication: %7" PRId64 " us, %6" PRIu64 " kB/s, %4u bytes copied per send\n",
+           indication_us, indication_us ? bytes * 1000 / indication_us : 0, indication_bytes);
+    (void)sink;
+}
+
+/*
+ * Two agents on the loopback exchange only their relayed candidates, so that
+ * the selected pair goes through the TURN allocations of the embedded server
+ * and every datagram is wrapped in ChannelData by the sending agent.
+ */
+typedef struct {
+    juice_agent_t *agent;
+    juice_agent_t *peer;
+    SemaphoreHandle_t received;
+    volatile bool connected;
+    volatile size_t last_size;
+    volatile uint8_t last_first;
+} side_t;
+
+static side_t s_sides[2];
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if (state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED) {
+        side->connected = true;
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if (strstr(sdp, "typ relay")) {
+        juice_add_remote_candidate(side->peer, sdp);
+    }
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    juice_set_remote_gathering_done(side->peer);
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    side->last_size = size;
+    side->last_first = size ? (uint8_t)data[0] : 0;
+    xSemaphoreGive(side->received);
+}
+
+static void destroy_agents(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        juice_destroy(s_sides[i].agent);
+        s_sides[i].agent = NULL;
+        if (s_sides[i].received) {
+            vSemaphoreDelete(s_sides[i].received);
+            s_sides[i].received = NULL;
+        }
+    }
+}
+
+static int connect_relayed(void)
+{
+    static juice_turn_server_t turn = {
+        .host = "127.0.0.1",
+        .username = "esp-ice",
+        .password = "relay",
+        .port = SERVER_PORT,
+    };
+    memset(s_sides, 0, sizeof(s_sides));
+    for (int i = 0; i < 2; ++i) {
+        juice_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.bind_address = "127.0.0.1";
+        config.local_port_range_begin = AGENT_PORT + i;
+        config.local_port_range_end = AGENT_PORT + i;
+        config.turn_servers = &turn;
+        config.turn_servers_count = 1;
+        config.cb_state_changed = on_state_changed;
+        config.cb_candidate = on_candidate;
+        config.cb_gathering_done = on_gathering_done;
+        config.cb_recv = on_recv;
+        config.user_ptr = &s_sides[i];
+        s_sides[i].received = xSemaphoreCreateCounting(BENCH_ROUNDS, 0);
+        s_sides[i].agent = juice_create(&config);
+        if (s_sides[i].received == NULL || s_sides[i].agent == NULL) {
+            printf("Agent creation failed\n");
+            destroy_agents();
+            return -1;
+        }
+    }
+    s_sides[0].peer = s_sides[1].agent;
+    s_sides[1].peer = s_sides[0].agent;
+
+    char sdp[JUICE_MAX_SDP_STRING_LEN];
+    juice_get_local_description(s_sides[0].agent, sdp, sizeof(sdp));
+    juice_set_remote_description(s_sides[1].agent, sdp);
+    juice_get_local_description(s_sides[1].agent, sdp, sizeof(sdp));
+    juice_set_remote_description(s_sides[0].agent, sdp);
+    juice_gather_candidates(s_sides[0].agent);
+    juice_gather_candidates(s_sides[1].agent);
+    for (int waited = 0; !(s_sides[0].connected && s_sides[1].connected); waited += 10) {
+        if (waited >= CONNECT_TIMEOUT_MS) {
+            printf("Agents did not connect through the relay\n");
+            destroy_agents();
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    char local[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+    char remote[JUICE_MAX_CANDIDATE_SDP_STRING_LEN];
+    if (juice_get_selected_candidates(s_sides[0].agent, local, sizeof(local), remote, sizeof(remote)) ||
+            !strstr(local, "typ relay")) {
+        printf("Selected pair is not relayed\n");
+        destroy_agents();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Each round the application writes the payload, hands it to the agent and
+ * waits for the peer to receive it through the relay. send_us only covers the
+ * juice_send()/juice_send_buf() calls, the part the framing changes.
+ */
+static int bench(size_t payload_size, bool in_place, int64_t *send_us, int64_t *total_us)
+{
+    static uint8_t app[MAX_PAYLOAD];
+    static uint8_t storage[JUICE_SEND_HEADROOM + MAX_PAYLOAD + JUICE_SEND_TAILROOM];
+    juice_sendbuf_t sb;
+    juice_sendbuf_init(&sb, storage, sizeof(storage));
+    juice_sendbuf_set_len(&sb, payload_size);
+    while (xSemaphoreTake(s_sides[1].received, 0) == pdTRUE) {
+    }
+
+    int delivered = 0;
+    *send_us = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ROUNDS; ++i) {
+        int64_t before = esp_timer_get_time();
+        int ret;
+        if (in_place) {
+            fill_payload(juice_sendbuf_payload(&sb), payload_size, i); // The application produces the payload in place
+            ret = juice_send_buf(s_sides[0].agent, &sb);
+        } else {
+            fill_payload(app, payload_size, i); // The application produces the payload in its own buffer
+            ret = juice_send(s_sides[0].agent, (const char *)app, payload_size);
+        }
+        *send_us += esp_timer_get_time() - before;
+        if (ret != JUICE_ERR_SUCCESS) {
+            printf("Relayed send failed\n");
+            return -1;
+        }
+        uint8_t first = in_place ? juice_sendbuf_payload(&sb)[0] : app[0];
+        if (xSemaphoreTake(s_sides[1].received, pdMS_TO_TICKS(100)) == pdTRUE &&
+                s_sides[1].last_size == payload_size && s_sides[1].last_first == first) {
+            ++delivered;
+        }
+    }
+    *total_us = esp_timer_get_time() - start;
+    return delivered;
+}
+
+static int bench_payload(size_t payload_size)
+{
+    int64_t copy_send_us, copy_total_us, in_place_send_us, in_place_total_us;
+    int copy_delivered = bench(payload_size, false, &copy_send_us, &copy_total_us);
+    int in_place_delivered = bench(payload_size, true, &in_place_send_us, &in_place_total_us);
+    if (copy_delivered < 0 || in_place_delivered < 0) {
+        return -1;
+    }
+    printf("%4u bytes payload, %d relayed round trips:\n", (unsigned)payload_size, BENCH_ROUNDS);
+    printf("  juice_send (copy + ChannelData): %4d delivered, %7" PRId64 " us in send, %7" PRId64 " us total\n",
+           copy_delivered, copy_send_us, copy_total_us);
+    printf("  juice_send_buf (in place)      : %4d delivered, %7" PRId64 " us in send, %7" PRId64 " us total\n",
+           in_place_delivered, in_place_send_us, in_place_total_us);
+    // Both paths must produce ChannelData the server accepts and relays, and the loopback does not lose
+    // datagrams at one in flight: every one of them must arrive
+    if (copy_delivered != BENCH_ROUNDS || in_place_delivered != BENCH_ROUNDS) {
+        printf("Relayed datagrams lost\n");
+        return -1;
+    }
+    return 0;
+}
+
+int test_relay_frame(void)
+{
+    struct sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(3478);
+    inet_pton(AF_INET, "192.0.2.1", &peer.sin_addr);
+
+    if (check_frames(&peer)) {
+        return -1;
+    }
+    bench_framing(160, &peer);
+    bench_framing(MAX_PAYLOAD, &peer);
+
+    juice_server_credentials_t credentials = {
+        .username = "esp-ice",
+        .password = "relay",
+        .allocations_quota = 2,
+    };
+    juice_server_config_t server_config;
+    memset(&server_config, 0, sizeof(server_config));
+    server_config.credentials = &credentials;
+    server_config.credentials_count = 1;
+    server_config.max_allocations = 2;
+    server_config.bind_address = "127.0.0.1";
+    server_config.external_address = "127.0.0.1";
+    server_config.port = SERVER_PORT;
+    server_config.relay_port_range_begin = RELAY_PORT_BEGIN;
+    server_config.relay_port_range_end = RELAY_PORT_END;
+    juice_server_t *server = juice_server_create(&server_config);
+    if (server == NULL) {
+        printf("Failed to create the TURN server\n");
+        return -1;
+    }
+    if (connect_relayed()) {
+        juice_server_destroy(server);
+        return -1;
+    }
+
+    // Unless the connectivity checks already bound the channel, the first send requests the binding and
+    // goes out as a Send indication built in place
+    static uint8_t warmup[JUICE_SEND_HEADROOM + 16 + JUICE_SEND_TAILROOM];
+    juice_sendbuf_t sb;
+    juice_sendbuf_init(&sb, warmup, sizeof(warmup));
+    memcpy(juice_sendbuf_payload(&sb), "Hello from 0", 12);
+    juice_sendbuf_set_len(&sb, 12);
+    int ret = juice_send_buf(s_sides[0].agent, &sb) == JUICE_ERR_SUCCESS ? 0 : -1;
+    if (ret == 0 && (xSemaphoreTake(s_sides[1].received, pdMS_TO_TICKS(CHANNEL_BIND_MS)) != pdTRUE ||
+                     s_sides[1].last_size != 12 || s_sides[1].last_first != 'H')) {
+        printf("Send indication built in place not delivered\n");
+        ret = -1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(CHANNEL_BIND_MS));
+
+    if (ret == 0) {
+        ret = bench_payload(160);
+    }
+    if (ret == 0) {
+        ret = bench_payload(MAX_PAYLOAD);
+    }
+    destroy_agents();
+    juice_server_destroy(server);
+    return ret;
+}
@@ -0,0 +1,479 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "juice/juice.h"
+#include "juice_stun_fast.h"
+
+#define FUZZ_ITERATIONS 200000
+#define BENCH_PACKETS 1000000
+#define AGENT_PORT 3460
+#define CONNECT_TIMEOUT_MS 5000
+#define AGENT_ROUNDS 300
+#define AGENT_FOREIGN 3     // Stray datagrams per round, within the default UDP receive mailbox of lwIP
+#define AGENT_PAYLOAD 160
+
+static const uint8_t s_txn[JUICE_STUN_TRANSACTION_SIZE] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+static juice_agent_t *s_agents[2];
+
+static size_t put_attr(uint8_t *buf, size_t pos, uint16_t type, const void *value, uint16_t len)
+{
+    buf[pos] = type >> 8;
+    buf[pos + 1] = type & 0xFF;
+    buf[pos + 2] = len >> 8;
+    buf[pos + 3] = len & 0xFF;
+    memcpy(buf + pos + 4, value, len);
+    size_t padded = (len + 3) & ~3;
+    memset(buf + pos + 4 + len, 0, padded - len);
+    return pos + 4 + padded;
+}
+
+static void put_length(uint8_t *buf, size_t pos)
+{
+    buf[2] = (pos - JUICE_STUN_HEADER_SIZE) >> 8;
+    buf[3] = (pos - JUICE_STUN_HEADER_SIZE) & 0xFF;
+}
+
+// Binding request as sent by a controlling agent: USERNAME, PRIORITY, ICE-CONTROLLING, MESSAGE-INTEGRITY, FINGERPRINT
+static size_t make_binding_request(uint8_t *buf)
+{
+    static const uint8_t zeros[20] = { 0 };
+    static const uint8_t prio[4] = { 0x6e, 0x00, 0x1e, 0xff };
+    static const uint8_t tie[8] = { 0xde, 0xad, 0xbe, 0xef, 0, 0, 0, 1 };
+    buf[0] = 0x00;
+    buf[1] = 0x01;
+    buf[4] = 0x21;
+    buf[5] = 0x12;
+    buf[6] = 0xA4;
+    buf[7] = 0x42;
+    memcpy(buf + 8, s_txn, sizeof(s_txn));
+    size_t pos = JUICE_STUN_HEADER_SIZE;
+    pos = put_attr(buf, pos, 0x0006, "abcd:efgh", 9);
+    pos = put_attr(buf, pos, 0x0024, prio, sizeof(prio));
+    pos = put_attr(buf, pos, 0x802A, tie, sizeof(tie));
+    pos = put_attr(buf, pos, 0x0008, zeros, sizeof(zeros));
+    put_length(buf, pos + 8);
+    uint32_t crc = esp_rom_crc32_le(0, buf, pos) ^ 0x5354554e;
+    uint8_t fp[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    pos = put_attr(buf, pos, 0x8028, fp, sizeof(fp));
+    return pos;
+}
+
+static size_t make_channel_data(uint8_t *buf, size_t payload)
+{
+    buf[0] = 0x40;
+    buf[1] = 0x01;
+    buf[2] = payload >> 8;
+    buf[3] = payload & 0xFF;
+    memset(buf + 4, 0xAB, payload);
+    return 4 + payload;
+}
+
+static bool lookup_txn(const uint8_t *transaction_id, void *user_ptr)
+{
+    return memcmp(transaction_id, s_txn, sizeof(s_txn)) == 0;
+}
+
+// Application payloads whose first byte falls in the STUN or ChannelData ranges of RFC 7983
+static size_t make_app_payload(uint8_t *buf, uint8_t first, size_t len)
+{
+    memset(buf, 'x', len);
+    buf[0] = first;
+    return len;
+}
+
+static int check_vectors(void)
+{
+    uint8_t buf[256];
+    juice_stun_header_t stun;
+    juice_channel_data_header_t chan;
+    juice_stun_fast_msg_t msg;
+
+    size_t len = make_binding_request(buf);
+    if (juice_pkt_classify(buf, len, false, &stun, NULL) != JUICE_PKT_STUN ||
+            stun.msg_class != JUICE_STUN_CLASS_REQUEST || stun.method != 0x0001) {
+        printf("Binding request not classified as STUN\n");
+        return -1;
+    }
+    uint32_t wanted = JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_USERNAME) | JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_FINGERPRINT);
+    if (juice_stun_fast_parse(buf, len, wanted, &msg) != 0 || msg.found != wanted ||
+            msg.attrs[JUICE_STUN_ATTR_USERNAME].length != 9 ||
+            msg.attrs[JUICE_STUN_ATTR_PRIORITY].value != NULL) {
+        printf("Selective parsing failed\n");
+        return -1;
+    }
+    if (!juice_stun_fast_check_fingerprint(buf, &msg)) {
+        printf("Fingerprint check failed\n");
+        return -1;
+    }
+    buf[JUICE_STUN_HEADER_SIZE + 4] ^= 0x01;
+    if (juice_stun_fast_check_fingerprint(buf, &msg) ||
+            juice_stun_fast_demux(buf, len, NULL, NULL) != JUICE_PKT_INVALID) {
+        printf("Corrupted message passed the fingerprint check\n");
+        return -1;
+    }
+    buf[JUICE_STUN_HEADER_SIZE + 4] ^= 0x01;
+    if (juice_stun_fast_demux(buf, len, NULL, NULL) != JUICE_PKT_STUN) {
+        printf("Binding request dropped by the receive path\n");
+        return -1;
+    }
+
+    // Foreign responses are dropped before parsing
+    buf[1] = 0x01;
+    buf[0] = 0x01; // Binding success response
+    juice_pkt_classify(buf, len, false, &stun, NULL);
+    if (!juice_stun_fast_accept(&stun, lookup_txn, NULL)) {
+        printf("Known transaction rejected\n");
+        return -1;
+    }
+    buf[8] ^= 0xFF;
+    if (juice_stun_fast_accept(&stun, lookup_txn, NULL)) {
+        printf("Unknown transaction accepted\n");
+        return -1;
+    }
+    buf[8] ^= 0xFF;
+
+    if (juice_pkt_classify(buf, len - 4, false, NULL, NULL) != JUICE_PKT_INVALID) {
+        printf("Truncated STUN not rejected\n");
+        return -1;
+    }
+    buf[4] = 0x00; // Without the magic cookie it is not STUN
+    if (juice_pkt_classify(buf, len, false, NULL, NULL) != JUICE_PKT_APP) {
+        printf("Datagram without the magic cookie not left to the application\n");
+        return -1;
+    }
+    buf[4] = 0x21;
+
+    len = make_channel_data(buf, 13);
+    if (juice_pkt_classify(buf, len, true, NULL, &chan) != JUICE_PKT_CHANNEL_DATA || chan.length != 13 ||
+            juice_pkt_classify(buf, len + 3, true, NULL, NULL) != JUICE_PKT_CHANNEL_DATA ||
+            juice_pkt_classify(buf, len + 4, true, NULL, NULL) != JUICE_PKT_INVALID ||
+            juice_pkt_classify(buf, len - 1, true, NULL, NULL) != JUICE_PKT_INVALID) {
+        printf("ChannelData validation failed\n");
+        return -1;
+    }
+    // The same bytes from a peer are application data
+    if (juice_pkt_classify(buf, len, false, NULL, NULL) != JUICE_PKT_APP) {
+        printf("ChannelData accepted from a peer\n");
+        return -1;
+    }
+
+    // First bytes of STUN (0x00-0x03), ChannelData ('@', 'H') and RTP, at STUN and shorter sizes
+    static const uint8_t firsts[] = { 0x00, 0x01, 0x02, 0x03, '@', 'H', 0x80 };
+    for (int i = 0; i < sizeof(firsts); ++i) {
+        for (size_t n = 1; n <= 64; n += 7) {
+            len = make_app_payload(buf, firsts[i], n);
+            if (juice_pkt_classify(buf, len, false, NULL, NULL) != JUICE_PKT_APP ||
+                    juice_stun_fast_demux(buf, len, lookup_txn, NULL) != JUICE_PKT_APP) {
+                printf("Application datagram 0x%02x (%u B) not classified as such\n", firsts[i], (unsigned)n);
+                return -1;
+            }
+        }
+    }
+    len = strlen("Hello from 1");
+    memcpy(buf, "Hello from 1", len);
+    if (juice_stun_fast_demux(buf, len, lookup_txn, NULL) != JUICE_PKT_APP) {
+        printf("Text datagram not classified as application data\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int fuzz(void)
+{
+    uint8_t seed[256];
+    uint8_t buf[256];
+    size_t seed_len = make_binding_request(seed);
+    juice_stun_header_t stun;
+    juice_stun_fast_msg_t msg;
+
+    for (int i = 0; i < FUZZ_ITERATIONS; ++i) {
+        uint32_t r = esp_random();
+        size_t len;
+        if (r & 1) {
+            // Mutate a valid message: a few byte flips and an optional truncation
+            memcpy(buf, seed, seed_len);
+            len = seed_len;
+            for (int n = (r >> 1) & 0x3; n >= 0; --n) {
+                buf[esp_random() % len] ^= (uint8_t)esp_random();
+            }
+            if (r & 0x10) {
+                len = esp_random() % (len + 1);
+            }
+        } else {
+            len = esp_random() % sizeof(buf);
+            esp_fill_random(buf, len);
+            buf[0] &= (r & 2) ? 0x03 : 0xFF;
+        }
+
+        juice_pkt_class_t cls = juice_pkt_classify(buf, len, r & 4, &stun, NULL);
+        if (cls != JUICE_PKT_STUN) {
+            continue;
+        }
+        if (juice_stun_fast_parse(buf, len, ~0u, &msg) != 0) {
+            continue;
+        }
+        for (int id = 0; id < JUICE_STUN_ATTR_COUNT; ++id) {
+            const juice_stun_attr_view_t *a = &msg.attrs[id];
+            if (a->value && (a->value < buf || a->value + a->length > buf + len)) {
+                printf("Fuzzing: attribute %d out of bounds at iteration %d\n", id, i);
+                return -1;
+            }
+        }
+        juice_stun_fast_check_fingerprint(buf, &msg);
+    }
+    printf("Fuzzing: %d inputs processed\n", FUZZ_ITERATIONS);
+    return 0;
+}
+
+typedef struct {
+    uint8_t data[200];
+    size_t size;
+    bool from_relay;
+} vector_t;
+
+/*
+ * Packets classified per second: 1 STUN datagram out of 8, the rest application
+ * datagrams (some starting like STUN or ChannelData) and ChannelData from a TURN
+ * server. Accepted STUN also gets its FINGERPRINT checked, as in the receive path.
+ */
+static void bench_classify(void)
+{
+    static vector_t vectors[8];
+    vectors[0].size = make_binding_request(vectors[0].data);
+    vectors[1].size = make_app_payload(vectors[1].data, 0x80, 172); // RTP
+    vectors[2].size = make_app_payload(vectors[2].data, 0x17, 120); // DTLS application data
+    vectors[3].size = make_app_payload(vectors[3].data, 0x00, 160);
+    vectors[4].size = make_app_payload(vectors[4].data, '@', 64);
+    vectors[5].size = strlen("Hello from 1");
+    memcpy(vectors[5].data, "Hello from 1", vectors[5].size);
+    vectors[6].size = make_channel_data(vectors[6].data, 160);
+    vectors[6].from_relay = true;
+    vectors[7].size = make_app_payload(vectors[7].data, 0x80, 1200);
+
+    juice_stun_header_t stun;
+    juice_channel_data_header_t chan;
+    juice_stun_fast_msg_t msg;
+    volatile int sink = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_PACKETS; ++i) {
+        const vector_t *v = &vectors[i & 7];
+        juice_pkt_class_t cls = juice_pkt_classify(v->data, v->size, v->from_relay, &stun, &chan);
+        if (cls == JUICE_PKT_STUN && juice_stun_fast_accept(&stun, lookup_txn, NULL) &&
+                juice_stun_fast_parse(v->data, v->size, JUICE_STUN_ATTR_BIT(JUICE_STUN_ATTR_FINGERPRINT), &msg) == 0) {
+            sink += juice_stun_fast_check_fingerprint(v->data, &msg);
+        }
+        sink += cls;
+    }
+    int64_t mixed_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_PACKETS; ++i) {
+        const vector_t *v = &vectors[1 + (i % 5)];
+        sink += juice_pkt_classify(v->data, v->size, false, &stun, &chan);
+    }
+    int64_t app_us = esp_timer_get_time() - start;
+
+    printf("Mixed traffic: %d packets in %" PRId64 " us (%" PRId64 " packets/s)\n", BENCH_PACKETS, mixed_us,
+           mixed_us ? (int64_t)BENCH_PACKETS * 1000000 / mixed_us : 0);
+    printf("Application only: %d packets in %" PRId64 " us (%" PRId64 " ns/packet)\n", BENCH_PACKETS, app_us,
+           app_us * 1000 / BENCH_PACKETS);
+    (void)sink;
+}
+
+typedef struct {
+    SemaphoreHandle_t received;
+    volatile bool connected;
+} side_t;
+
+static side_t s_sides[2];
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if (state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED) {
+        side->connected = true;
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    juice_add_remote_candidate(s_agents[user_ptr == &s_sides[0] ? 1 : 0], sdp);
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    juice_set_remote_gathering_done(s_agents[user_ptr == &s_sides[0] ? 1 : 0]);
+}
+
+static void on_recv(juice_agent_t *agent, const char *data, size_t size, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    xSemaphoreGive(side->received);
+}
+
+// Binding success response to a transaction the agent never started: XOR-MAPPED-ADDRESS, SOFTWARE, FINGERPRINT
+static size_t make_foreign_response(uint8_t *buf)
+{
+    static const uint8_t mapped[8] = { 0x00, 0x01, 0x21, 0x12, 0x5e, 0x12, 0xa4, 0x43 };
+    buf[0] = 0x01;
+    buf[1] = 0x01;
+    buf[4] = 0x21;
+    buf[5] = 0x12;
+    buf[6] = 0xA4;
+    buf[7] = 0x42;
+    esp_fill_random(buf + 8, JUICE_STUN_TRANSACTION_SIZE);
+    size_t pos = JUICE_STUN_HEADER_SIZE;
+    pos = put_attr(buf, pos, 0x0020, mapped, sizeof(mapped));
+    pos = put_attr(buf, pos, 0x8022, "esp-ice stray server", 20);
+    put_length(buf, pos + 8);
+    uint32_t crc = esp_rom_crc32_le(0, buf, pos) ^ 0x5354554e;
+    uint8_t fp[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    return put_attr(buf, pos, 0x8028, fp, sizeof(fp));
+}
+
+static int connect_agents(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        s_sides[i].connected = false;
+        juice_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.bind_address = "127.0.0.1";
+        config.local_port_range_begin = AGENT_PORT + i;
+        config.local_port_range_end = AGENT_PORT + i;
+        config.cb_state_changed = on_state_changed;
+        config.cb_candidate = on_candidate;
+        config.cb_gathering_done = on_gathering_done;
+        config.cb_recv = on_recv;
+        config.user_ptr = &s_sides[i];
+        s_agents[i] = juice_create(&config);
+    }
+    if (s_agents[0] == NULL || s_agents[1] == NULL) {
+        printf("Agent creation failed\n");
+        return -1;
+    }
+    char sdp[JUICE_MAX_SDP_STRING_LEN];
+    juice_get_local_description(s_agents[0], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[1], sdp);
+    juice_get_local_description(s_agents[1], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[0], sdp);
+    juice_gather_candidates(s_agents[0]);
+    juice_gather_candidates(s_agents[1]);
+    for (int waited = 0; !(s_sides[0].connected && s_sides[1].connected); waited += 10) {
+        if (waited >= CONNECT_TIMEOUT_MS) {
+            printf("Agents did not connect\n");
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return 0;
+}
+
+/*
+ * Datagrams received by a connected agent through its real receive path: each round
+ * sends stray STUN responses and a truncated STUN message from a foreign socket, then
+ * one application datagram from the peer, starting with a byte of the STUN or
+ * ChannelData ranges, and waits for the latter to be delivered.
+ */
+static int receive_rounds(int sock, bool fast, juice_stun_fast_stats_t *stats)
+{
+    static const uint8_t firsts[] = { 0x00, 0x01, 0x02, 0x03, '@' };
+    static uint8_t foreign[128];
+    static uint8_t payload[AGENT_PAYLOAD];
+    struct sockaddr_in dst = {
+        .sin_family = AF_INET,
+        .sin_port = htons(AGENT_PORT + 1),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    juice_stun_fast_set_enabled(fast);
+    juice_stun_fast_get_stats(stats, true);
+    while (xSemaphoreTake(s_sides[1].received, 0) == pdTRUE) {
+    }
+
+    int delivered = 0;
+    for (int i = 0; i < AGENT_ROUNDS; ++i) {
+        for (int k = 0; k < AGENT_FOREIGN; ++k) {
+            size_t len = make_foreign_response(foreign);
+            // The last one is cut short, malformed
+            sendto(sock, foreign, k == AGENT_FOREIGN - 1 ? len - 4 : len, 0, (struct sockaddr *)&dst, sizeof(dst));
+        }
+        size_t len = sizeof(payload);
+        size_t kind = i % (sizeof(firsts) + 1);
+        if (kind < sizeof(firsts)) {
+            make_app_payload(payload, firsts[kind], len);
+        } else {
+            len = strlen("Hello from 1");
+            memcpy(payload, "Hello from 1", len);
+        }
+        juice_send(s_agents[0], (const char *)payload, len);
+        if (xSemaphoreTake(s_sides[1].received, pdMS_TO_TICKS(100)) == pdTRUE) {
+            ++delivered;
+        }
+    }
+    juice_stun_fast_get_stats(stats, false);
+    juice_stun_fast_set_enabled(true);
+    return delivered;
+}
+
+static int check_receive_path(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        s_sides[i].received = xSemaphoreCreateCounting(AGENT_ROUNDS, 0);
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int ret = sock >= 0 && s_sides[0].received && s_sides[1].received ? connect_agents() : -1;
+
+    juice_stun_fast_stats_t stats[2];
+    int delivered[2] = { 0 };
+    for (int fast = 0; ret == 0 && fast < 2; ++fast) {
+        delivered[fast] = receive_rounds(sock, fast, &stats[fast]);
+        printf("%s path: %d rounds of %d stray STUN + 1 application datagram, %d delivered\n",
+               fast ? "Fast" : "Original", AGENT_ROUNDS, AGENT_FOREIGN, delivered[fast]);
+    }
+    if (ret == 0) {
+        printf("Fast path: %" PRIu32 " dropped before stun_read(), %" PRIu32 " STUN parsed, %" PRIu32 " application\n",
+               stats[1].dropped, stats[1].stun, stats[1].app);
+        if (delivered[0] != AGENT_ROUNDS || delivered[1] != AGENT_ROUNDS) {
+            printf("Application datagrams were lost\n");
+            ret = -1;
+        } else if (stats[1].dropped < AGENT_ROUNDS * AGENT_FOREIGN || stats[1].app < AGENT_ROUNDS) {
+            printf("Stray STUN reached stun_read() with the fast path enabled\n");
+            ret = -1;
+        } else if (stats[0].dropped || stats[0].stun || stats[0].app) {
+            printf("Fast path ran while disabled\n");
+            ret = -1;
+        }
+    }
+
+    juice_destroy(s_agents[0]);
+    juice_destroy(s_agents[1]);
+    if (sock >= 0) {
+        close(sock);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (s_sides[i].received) {
+            vSemaphoreDelete(s_sides[i].received);
+        }
+    }
+    return ret;
+}
+
+int test_stun_fast(void)
+{
+    if (check_vectors() || fuzz()) {
+        return -1;
+    }
+    bench_classify();
+    return check_receive_path();
+}
@@ -0,0 +1,349 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_netif.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "juice/juice.h"
+#include "juice_stun_race.h"
+
+#define DEAD_PORT 3470
+#define SLOW_PORT 3471
+#define FAST_PORT 3472
+#define DNS_PORT 53
+#define BIND_PORT 3480
+#define SLOW_DELAY_MS 800
+#define DNS_DELAY_MS 1500
+#define FAST_MAPPED "192.0.2.1"     // Synthetic mapped addresses telling the servers apart
+#define SLOW_MAPPED "192.0.2.2"
+#define GATHER_TIMEOUT_MS 5000
+
+/*
+ * An agent bound to 127.0.0.1 races local STUN servers while gathering: one
+ * answering at once, one answering after SLOW_DELAY_MS, a dead port and a name
+ * whose DNS answer takes DNS_DELAY_MS (a local DNS server replacing the
+ * netif's for the test). Each responder maps the requests to its own address,
+ * so the server-reflexive candidates tell which servers won.
+ */
+typedef struct {
+    uint16_t port;
+    int delay_ms;
+    const char *mapped;
+    volatile int requests;
+    uint8_t last_id[2];             // DNS: retransmitted queries are not answered twice
+    volatile bool stop;
+    volatile bool stopped;
+} responder_t;
+
+typedef struct {
+    int64_t start;
+    volatile int64_t host_us;       // First host candidate
+    volatile int64_t srflx_us;      // First server-reflexive candidate
+    volatile int64_t done_us;       // Gathering done
+    volatile bool fast_mapped;
+    volatile bool slow_mapped;
+} gather_t;
+
+static responder_t s_fast = { .port = FAST_PORT, .mapped = FAST_MAPPED };
+static responder_t s_slow = { .port = SLOW_PORT, .delay_ms = SLOW_DELAY_MS, .mapped = SLOW_MAPPED };
+static responder_t s_dns = { .port = DNS_PORT, .delay_ms = DNS_DELAY_MS };
+static int s_name_seq;
+
+static int bind_loopback(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    return sock;
+}
+
+// Binding success response with the mapped address of the responder, -1 if not a Binding request
+static int stun_response(const responder_t *r, const uint8_t *req, int len, const struct sockaddr_in *src,
+                         uint8_t *resp)
+{
+    if (len < 20 || req[0] != 0x00 || req[1] != 0x01) {
+        return -1;
+    }
+    memcpy(resp, req, 20);
+    resp[0] = 0x01;
+    resp[1] = 0x01;
+    resp[2] = 0;
+    resp[3] = 20;
+    uint8_t *attr = resp + 20;
+    attr[0] = 0x00;
+    attr[1] = 0x20; // XOR-MAPPED-ADDRESS
+    attr[2] = 0;
+    attr[3] = 8;
+    attr[4] = 0;
+    attr[5] = 0x01;
+    struct in_addr mapped;
+    inet_pton(AF_INET, r->mapped, &mapped);
+    memcpy(attr + 6, &src->sin_port, 2);
+    memcpy(attr + 8, &mapped, 4);
+    for (int i = 0; i < 6; ++i) {
+        attr[6 + i] ^= req[4 + (i < 2 ? i : i - 2)];
+    }
+    attr += 12;
+    uint32_t crc = esp_rom_crc32_le(0, resp, attr - resp) ^ 0x5354554e;
+    attr[0] = 0x80;
+    attr[1] = 0x28; // FINGERPRINT
+    attr[2] = 0;
+    attr[3] = 4;
+    attr[4] = crc >> 24;
+    attr[5] = crc >> 16;
+    attr[6] = crc >> 8;
+    attr[7] = crc;
+    return 40;
+}
+
+// A record of 127.0.0.1 for an A query, -1 otherwise
+static int dns_response(const uint8_t *query, int len, uint8_t *resp, size_t size)
+{
+    int pos = 12;
+    while (pos < len && query[pos] != 0) {
+        pos += query[pos] + 1;
+    }
+    pos += 5;
+    if (len < 12 || pos > len || (size_t)pos + 16 > size || query[pos - 3] != 1) {
+        return -1;
+    }
+    static const uint8_t answer[] = {
+        0xc0, 0x0c,             // Name of the question
+        0x00, 0x01, 0x00, 0x01, // A, IN
+        0x00, 0x00, 0x00, 0x00, // TTL 0, not cached
+        0x00, 0x04, 127, 0, 0, 1,
+    };
+    memcpy(resp, query, pos);
+    resp[2] = 0x81;
+    resp[3] = 0x80;
+    resp[6] = 0;
+    resp[7] = 1;
+    memset(resp + 8, 0, 4);
+    memcpy(resp + pos, answer, sizeof(answer));
+    return pos + sizeof(answer);
+}
+
+// Answers after a fixed delay, one request at a time
+static void responder_task(void *arg)
+{
+    responder_t *r = arg;
+    int sock = bind_loopback(r->port);
+    while (!r->stop) {
+        uint8_t buf[512];
+        uint8_t resp[512];
+        struct sockaddr_in src;
+        socklen_t src_len = sizeof(src);
+        int len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&src, &src_len);
+        if (len <= 0) {
+            continue;
+        }
+        ++r->requests;
+        if (r->port == DNS_PORT && len >= 2) {
+            if (memcmp(buf, r->last_id, 2) == 0) {
+                continue;
+            }
+            memcpy(r->last_id, buf, 2);
+        }
+        vTaskDelay(pdMS_TO_TICKS(r->delay_ms));
+        len = r->port == DNS_PORT ? dns_response(buf, len, resp, sizeof(resp))
+                                  : stun_response(r, buf, len, &src, resp);
+        if (len > 0) {
+            sendto(sock, resp, len, 0, (struct sockaddr *)&src, src_len);
+        }
+    }
+    close(sock);
+    r->stopped = true;
+    vTaskDelete(NULL);
+}
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    gather_t *g = user_ptr;
+    if (strstr(sdp, "typ host") && g->host_us == 0) {
+        g->host_us = esp_timer_get_time() - g->start;
+    } else if (strstr(sdp, "typ srflx")) {
+        if (g->srflx_us == 0) {
+            g->srflx_us = esp_timer_get_time() - g->start;
+        }
+        g->fast_mapped |= strstr(sdp, " " FAST_MAPPED " ") != NULL;
+        g->slow_mapped |= strstr(sdp, " " SLOW_MAPPED " ") != NULL;
+    }
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    gather_t *g = user_ptr;
+    g->done_us = esp_timer_get_time() - g->start;
+}
+
+static juice_agent_t *start_gathering(gather_t *g, const juice_stun_server_t *servers, int count,
+                                      int min_responses)
+{
+    memset(g, 0, sizeof(*g));
+    s_fast.requests = 0;
+    s_slow.requests = 0;
+    juice_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.bind_address = "127.0.0.1";
+    config.local_port_range_begin = BIND_PORT;
+    config.local_port_range_end = BIND_PORT;
+    config.stun_servers = servers;
+    config.stun_servers_count = count;
+    config.stun_min_responses = min_responses;
+    config.cb_state_changed = on_state_changed;
+    config.cb_candidate = on_candidate;
+    config.cb_gathering_done = on_gathering_done;
+    config.user_ptr = g;
+    juice_agent_t *agent = juice_create(&config);
+    if (agent == NULL) {
+        printf("Agent creation failed\n");
+        return NULL;
+    }
+    char sdp[JUICE_MAX_SDP_STRING_LEN];
+    juice_get_local_description(agent, sdp, sizeof(sdp));
+    g->start = esp_timer_get_time();
+    juice_gather_candidates(agent);
+    return agent;
+}
+
+static bool wait_done(const gather_t *g)
+{
+    int64_t start = esp_timer_get_time();
+    while (g->done_us == 0) {
+        if (esp_timer_get_time() - start > GATHER_TIMEOUT_MS * 1000LL) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return true;
+}
+
+// A fresh name for each lookup, so that none is answered from the DNS cache
+static const char *slow_name(char *buf, size_t size)
+{
+    snprintf(buf, size, "slow-%d.esp-ice.test", ++s_name_seq);
+    return buf;
+}
+
+static int race(const char *name, int min_responses, int min_done_ms, int max_done_ms, bool slow_mapped)
+{
+    char host[32];
+    const juice_stun_server_t servers[] = {
+        { "127.0.0.1", DEAD_PORT },
+        { slow_name(host, sizeof(host)), FAST_PORT },
+        { "127.0.0.1", SLOW_PORT },
+        { "127.0.0.1", FAST_PORT },
+    };
+    gather_t g;
+    juice_agent_t *agent = start_gathering(&g, servers, 4, min_responses);
+    if (agent == NULL) {
+        return -1;
+    }
+    bool done = wait_done(&g);
+    int done_ms = g.done_us / 1000;
+    // Past the DNS answer, whose server must not be queried anymore
+    vTaskDelay(pdMS_TO_TICKS(DNS_DELAY_MS + 500));
+    juice_destroy(agent);
+    printf("%s: host candidate after %d ms, gathering done after %d ms, fast server queried %d times, "
+           "slow %d\n", name, (int)(g.host_us / 1000), done_ms, s_fast.requests, s_slow.requests);
+    if (!done || g.host_us == 0 || g.host_us > 100 * 1000 || done_ms < min_done_ms || done_ms > max_done_ms) {
+        printf("%s: unexpected timing\n", name);
+        return -1;
+    }
+    // The numeric servers answer at once, but only after the host candidates are out
+    if (g.srflx_us == 0 || g.srflx_us < g.host_us) {
+        printf("%s: server-reflexive candidate before the host candidates\n", name);
+        return -1;
+    }
+    if (!g.fast_mapped || g.slow_mapped != slow_mapped || s_fast.requests != 1 || s_slow.requests < 1) {
+        printf("%s: unexpected candidates or requests\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+static int destroy_while_resolving(void)
+{
+    char host[32];
+    const juice_stun_server_t servers[] = {
+        { slow_name(host, sizeof(host)), FAST_PORT },
+    };
+    gather_t g;
+    juice_agent_t *agent = start_gathering(&g, servers, 1, 1);
+    if (agent == NULL) {
+        return -1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+    int64_t start = esp_timer_get_time();
+    juice_destroy(agent);
+    int destroy_ms = (esp_timer_get_time() - start) / 1000;
+    // The lookup completes after the agent is gone and must be dropped
+    vTaskDelay(pdMS_TO_TICKS(DNS_DELAY_MS + 500));
+    printf("destroy while resolving: juice_destroy() took %d ms, fast server queried %d times\n", destroy_ms,
+           s_fast.requests);
+    if (destroy_ms > 200 || g.done_us != 0 || s_fast.requests != 0) {
+        printf("destroy while resolving: unexpected result\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_responder(responder_t *r)
+{
+    r->stop = true;
+    while (!r->stopped) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+int test_stun_race(void)
+{
+    esp_netif_t *netif = esp_netif_get_default_netif();
+    esp_netif_dns_info_t saved_dns, local_dns;
+    if (netif == NULL || esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &saved_dns) != ESP_OK) {
+        printf("No default netif to point at the local DNS server\n");
+        return -1;
+    }
+    memset(&local_dns, 0, sizeof(local_dns));
+    local_dns.ip.type = ESP_IPADDR_TYPE_V4;
+    local_dns.ip.u_addr.ip4.addr = htonl(INADDR_LOOPBACK);
+    esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &local_dns);
+
+    xTaskCreate(responder_task, "fast_stun", 4096, &s_fast, 5, NULL);
+    xTaskCreate(responder_task, "slow_stun", 4096, &s_slow, 5, NULL);
+    xTaskCreate(responder_task, "slow_dns", 4096, &s_dns, 5, NULL);
+    int ret = 0;
+
+    // The fast server wins although it is listed last, the dead port, the slow server and the slow name
+    // are given up without delaying gathering
+    ret |= race("first response wins", 1, 0, 300, false);
+
+    // Two mappings: done when the slow server answers, still without waiting for the slow name
+    ret |= race("two responses", 2, SLOW_DELAY_MS, SLOW_DELAY_MS + 300, true);
+
+    // A lookup still running does not hold juice_destroy() back
+    ret |= destroy_while_resolving();
+
+    stop_responder(&s_fast);
+    stop_responder(&s_slow);
+    stop_responder(&s_dns);
+    esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &saved_dns);
+    return ret;
+}
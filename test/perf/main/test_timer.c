@@ -0,0 +1,221 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_pthread.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "juice/juice.h"
+#include "juice_timer.h"
+
+#define MAX_AGENTS 32
+#define AGENT_PORT 3520             // Measured agents, one port each
+#define PEER_PORT 3519              // Their peers share one socket in mux mode
+#define CONNECT_TIMEOUT_MS 10000
+#define SETTLE_MS 2000              // Let nomination and the last checks complete before counting
+#define IDLE_MS 32000               // Two keepalive periods
+#define HEAP_MARGIN 32768
+#define POLL_TASK_NAME "juice_poll"     // libjuice threads are pthreads, named through esp_pthread
+#define MUX_TASK_NAME "juice_mux"
+
+/*
+ * N agents of the poll backend, the one hooked to the timer service, are
+ * connected on the loopback to N peers of the mux backend and left idle, so
+ * that the measured conn loop only wakes for bookkeeping (keepalives) and for
+ * the traffic of the peers. The wakeups are counted by the conn loop itself,
+ * its CPU time is read from the FreeRTOS run-time stats of its task.
+ */
+typedef struct {
+    juice_agent_t *agent;
+    juice_agent_t *peer;
+    volatile bool connected;
+} side_t;
+
+static side_t s_sides[2 * MAX_AGENTS];
+static char s_sdp[JUICE_MAX_SDP_STRING_LEN];
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    if (state == JUICE_STATE_CONNECTED || state == JUICE_STATE_COMPLETED) {
+        side->connected = true;
+    }
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    juice_add_remote_candidate(side->peer, sdp);
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    side_t *side = user_ptr;
+    juice_set_remote_gathering_done(side->peer);
+}
+
+static juice_agent_t *create_agent(side_t *side, juice_concurrency_mode_t mode, uint16_t port)
+{
+    juice_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.concurrency_mode = mode;
+    config.bind_address = "127.0.0.1";
+    config.local_port_range_begin = port;
+    config.local_port_range_end = port;
+    config.cb_state_changed = on_state_changed;
+    config.cb_candidate = on_candidate;
+    config.cb_gathering_done = on_gathering_done;
+    config.user_ptr = side;
+    side->connected = false;
+    side->agent = juice_create(&config);
+    return side->agent;
+}
+
+// Name the thread of the conn backend started by the next juice_gather_candidates()
+static void name_conn_thread(const char *name)
+{
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = name;
+    esp_pthread_set_cfg(&cfg);
+}
+
+// Run time of the poll loop task so far, in run-time stats ticks (us with the esp_timer clock)
+static bool conn_task_run_time(configRUN_TIME_COUNTER_TYPE *run_time)
+{
+    TaskHandle_t task = xTaskGetHandle(POLL_TASK_NAME);
+    if (task == NULL) {
+        return false;
+    }
+    TaskStatus_t status;
+    vTaskGetInfo(task, &status, pdFALSE, eRunning);
+    *run_time = status.ulRunTimeCounter;
+    return true;
+}
+
+static void destroy_agents(int count)
+{
+    for (int i = 0; i < 2 * count; ++i) {
+        juice_destroy(s_sides[i].agent);
+        s_sides[i].agent = NULL;
+    }
+}
+
+static int connect_agents(int count)
+{
+    memset(s_sides, 0, sizeof(s_sides));
+    for (int i = 0; i < count; ++i) {
+        side_t *side = &s_sides[2 * i];
+        side_t *peer = &s_sides[2 * i + 1];
+        if (create_agent(side, JUICE_CONCURRENCY_MODE_POLL, AGENT_PORT + i) == NULL ||
+                create_agent(peer, JUICE_CONCURRENCY_MODE_MUX, PEER_PORT) == NULL) {
+            printf("Agent creation failed at %d of %d\n", i + 1, count);
+            destroy_agents(count);
+            return -1;
+        }
+        side->peer = peer->agent;
+        peer->peer = side->agent;
+        juice_get_local_description(side->agent, s_sdp, sizeof(s_sdp));
+        juice_set_remote_description(peer->agent, s_sdp);
+        juice_get_local_description(peer->agent, s_sdp, sizeof(s_sdp));
+        juice_set_remote_description(side->agent, s_sdp);
+        name_conn_thread(POLL_TASK_NAME);
+        juice_gather_candidates(side->agent);
+        name_conn_thread(MUX_TASK_NAME);
+        juice_gather_candidates(peer->agent);
+    }
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < 2 * count; ++i) {
+        while (!s_sides[i].connected) {
+            if (esp_timer_get_time() - start > CONNECT_TIMEOUT_MS * 1000LL) {
+                printf("%d agents did not connect\n", count);
+                destroy_agents(count);
+                return -1;
+            }
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+    return 0;
+}
+
+// Total wakeups of the poll loop over IDLE_MS and its CPU time in us, -1 on failure
+static int64_t measure(int count, bool coalesce, juice_timer_stats_t *stats, int64_t *cpu_us, size_t *heap_used)
+{
+    juice_conn_timer_set_coalescing(coalesce);
+    size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    int ret = connect_agents(count);
+    if (ret == 0) {
+        *heap_used = free_bytes - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+        configRUN_TIME_COUNTER_TYPE run_start, run_end;
+        juice_conn_timer_get_stats(JUICE_CONCURRENCY_MODE_POLL, true, stats);
+        bool found = conn_task_run_time(&run_start);
+        vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+        juice_conn_timer_get_stats(JUICE_CONCURRENCY_MODE_POLL, false, stats);
+        found = found && conn_task_run_time(&run_end);
+        destroy_agents(count);
+        if (!found) {
+            printf("No %s task to read the run time of\n", POLL_TASK_NAME);
+            ret = -1;
+        } else {
+            *cpu_us = (configRUN_TIME_COUNTER_TYPE)(run_end - run_start);
+        }
+    }
+    juice_conn_timer_set_coalescing(true);
+    return ret == 0 ? (int64_t)stats->wakeups + stats->spurious_wakeups : -1;
+}
+
+int test_timer(void)
+{
+#if !CONFIG_ESP_ICE_CONN_POLL || !CONFIG_ESP_ICE_CONN_MUX
+    printf("The poll and mux concurrency modes are both required, skipping\n");
+    return 0;
+#elif !CONFIG_FREERTOS_USE_TRACE_FACILITY || !CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    printf("FreeRTOS run-time stats are required for the CPU time, skipping\n");
+    return 0;
+#else
+    static const int agents[] = { 1, 8, 32 };
+    size_t pair_bytes = 0;
+    printf("Wakeups and CPU time of the poll loop over %d s with idle connected agents\n", IDLE_MS / 1000);
+    for (size_t i = 0; i < sizeof(agents) / sizeof(agents[0]); ++i) {
+        int count = agents[i];
+        size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (pair_bytes && free_bytes < count * pair_bytes + HEAP_MARGIN) {
+            printf("%2d agents: skipped, needs about %u bytes of heap, %u free\n", count,
+                   (unsigned)(count * pair_bytes + HEAP_MARGIN), (unsigned)free_bytes);
+            continue;
+        }
+
+        juice_timer_stats_t independent_stats, coalesced_stats;
+        int64_t independent_cpu_us, coalesced_cpu_us;
+        size_t heap_used;
+        int64_t independent = measure(count, false, &independent_stats, &independent_cpu_us, &heap_used);
+        if (independent < 0) {
+            return -1;
+        }
+        // Heap cost of a connected pair, to check that the larger runs fit
+        pair_bytes = heap_used / count;
+        int64_t coalesced = measure(count, true, &coalesced_stats, &coalesced_cpu_us, &heap_used);
+        if (coalesced < 0) {
+            return -1;
+        }
+
+        printf("%2d agents: independent %4" PRId64 " wakeups (%3" PRIu32 " timer, %3" PRIu32 " fired), %7" PRId64 " us CPU, "
+               "coalesced %4" PRId64 " wakeups (%3" PRIu32 " timer, %3" PRIu32 " fired), %7" PRId64 " us CPU\n", count,
+               independent, independent_stats.wakeups, independent_stats.timers_fired, independent_cpu_us,
+               coalesced, coalesced_stats.wakeups, coalesced_stats.timers_fired, coalesced_cpu_us);
+        // A single agent has a single deadline, coalescing can only keep the count
+        if (count > 1 ? coalesced >= independent : coalesced > independent) {
+            printf("%2d agents: coalescing did not reduce the wakeups\n", count);
+            return -1;
+        }
+    }
+    return 0;
+#endif
+}
@@ -0,0 +1,254 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "juice/juice.h"
+#include "juice_trace.h"
+
+#ifdef CONFIG_ESP_ICE_TRACE
+
+#define AGENT_PORT 3446
+#define STUN_PORT 3444          // Nothing listens there, only the lookup of the server matters
+#define CONNECT_TIMEOUT_MS 5000
+#define NOMINATION_TIMEOUT_MS 3000
+#define STUN_METHOD_BINDING 0x0001
+
+static juice_agent_t *s_agents[2];
+static volatile juice_state_t s_states[2];
+static juice_trace_event_t s_events[CONFIG_ESP_ICE_TRACE_EVENTS];
+
+static int check_ring(void)
+{
+    juice_trace_reset();
+    for (int i = 0; i < CONFIG_ESP_ICE_TRACE_EVENTS + 10; ++i) {
+        JUICE_TRACE_BEGIN(JUICE_TRACE_STUN_TRANSACTION, i);
+        JUICE_TRACE_END(JUICE_TRACE_STUN_TRANSACTION, i, 0x100);
+    }
+    static juice_trace_event_t events[CONFIG_ESP_ICE_TRACE_EVENTS];
+    size_t count = juice_trace_get_events(events, CONFIG_ESP_ICE_TRACE_EVENTS);
+    if (count != CONFIG_ESP_ICE_TRACE_EVENTS || events[0].phase != 'b' ||
+            events[count - 1].id != CONFIG_ESP_ICE_TRACE_EVENTS + 9 || events[count - 1].phase != 'e') {
+        printf("Trace ring does not keep the latest events\n");
+        return -1;
+    }
+    for (size_t i = 1; i < count; ++i) {
+        if (events[i].timestamp < events[i - 1].timestamp) {
+            printf("Trace events out of order\n");
+            return -1;
+        }
+    }
+
+    static char json[128 * CONFIG_ESP_ICE_TRACE_EVENTS];
+    FILE *out = fmemopen(json, sizeof(json), "w");
+    if (out == NULL || juice_trace_dump_chrome(out) != 0) {
+        printf("Chrome trace dump failed\n");
+        return -1;
+    }
+    fclose(out);
+    if (strncmp(json, "{\"traceEvents\":[", 16) != 0 || strstr(json, "\"name\":\"stun_transaction\"") == NULL ||
+            strcmp(json + strlen(json) - 4, "\n]}\n") != 0) {
+        printf("Malformed Chrome trace\n");
+        return -1;
+    }
+    juice_trace_reset();
+    return 0;
+}
+
+static void on_state_changed(juice_agent_t *agent, juice_state_t state, void *user_ptr)
+{
+    s_states[(intptr_t)user_ptr] = state;
+}
+
+static void on_candidate(juice_agent_t *agent, const char *sdp, void *user_ptr)
+{
+    juice_add_remote_candidate(s_agents[!(intptr_t)user_ptr], sdp);
+}
+
+static void on_gathering_done(juice_agent_t *agent, void *user_ptr)
+{
+    juice_set_remote_gathering_done(s_agents[!(intptr_t)user_ptr]);
+}
+
+static bool completed(int i)
+{
+    return s_states[i] == JUICE_STATE_COMPLETED;
+}
+
+static bool connected(int i)
+{
+    return s_states[i] == JUICE_STATE_CONNECTED || completed(i);
+}
+
+static int wait_for(bool (*done)(int), int timeout_ms)
+{
+    for (int waited = 0; !(done(0) && done(1)); waited += 10) {
+        if (waited >= timeout_ms) {
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return 0;
+}
+
+// Index of the first event of the agent matching stage, phase and arg (arg < 0: any), count if none
+static size_t find(size_t count, const juice_agent_t *agent, juice_trace_stage_t stage, char phase, int32_t arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)agent;
+    for (size_t i = 0; i < count; ++i) {
+        const juice_trace_event_t *ev = &s_events[i];
+        if (ev->stage == stage && ev->id == id && ev->phase == phase && (arg < 0 || ev->arg == arg)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+static size_t find_pair(size_t count, const juice_agent_t *agent, juice_trace_pair_state_t state)
+{
+    uint32_t id = (uint32_t)(uintptr_t)agent;
+    for (size_t i = 0; i < count; ++i) {
+        const juice_trace_event_t *ev = &s_events[i];
+        if (ev->stage == JUICE_TRACE_PAIR_STATE && ev->id == id && JUICE_TRACE_PAIR_STATE_OF(ev->arg) == state) {
+            return i;
+        }
+    }
+    return count;
+}
+
+// Timeline of one loopback connection, as recorded by the hooks and by the libjuice trace points
+static int check_connection(void)
+{
+    juice_trace_reset();
+    for (int i = 0; i < 2; ++i) {
+        s_states[i] = JUICE_STATE_DISCONNECTED;
+        juice_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.bind_address = "127.0.0.1";
+        config.local_port_range_begin = AGENT_PORT + i;
+        config.local_port_range_end = AGENT_PORT + i;
+        // Only the controlling agent resolves a server, its lookup must be in the timeline
+        config.stun_server_host = i == 0 ? "127.0.0.1" : NULL;
+        config.stun_server_port = STUN_PORT;
+        config.cb_state_changed = on_state_changed;
+        config.cb_candidate = on_candidate;
+        config.cb_gathering_done = on_gathering_done;
+        config.user_ptr = (void *)(intptr_t)i;
+        s_agents[i] = juice_create(&config);
+    }
+    int ret = -1;
+    if (s_agents[0] == NULL || s_agents[1] == NULL) {
+        printf("Agent creation failed\n");
+        goto cleanup;
+    }
+    char sdp[JUICE_MAX_SDP_STRING_LEN];
+    juice_get_local_description(s_agents[0], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[1], sdp);
+    juice_get_local_description(s_agents[1], sdp, sizeof(sdp));
+    juice_set_remote_description(s_agents[0], sdp);
+    juice_gather_candidates(s_agents[0]);
+    juice_gather_candidates(s_agents[1]);
+    if (wait_for(connected, CONNECT_TIMEOUT_MS) || wait_for(completed, NOMINATION_TIMEOUT_MS)) {
+        printf("Agents did not complete\n");
+        goto cleanup;
+    }
+
+    size_t count = juice_trace_get_events(s_events, CONFIG_ESP_ICE_TRACE_EVENTS);
+    if (count == CONFIG_ESP_ICE_TRACE_EVENTS) {
+        printf("Trace ring overflowed by one connection\n");
+        goto cleanup;
+    }
+    // The lookup is traced by its begin and end, whichever agent call triggers it
+    size_t resolve_begin = count, resolve_end = count;
+    for (size_t i = 0; i < count; ++i) {
+        if (s_events[i].stage == JUICE_TRACE_ADDR_RESOLVE) {
+            if (s_events[i].phase == 'b' && resolve_begin == count) {
+                resolve_begin = i;
+            } else if (s_events[i].phase == 'e' && resolve_begin < count && s_events[i].id == s_events[resolve_begin].id) {
+                resolve_end = i;
+                break;
+            }
+        }
+    }
+    if (resolve_end == count) {
+        printf("STUN server lookup of the agent not traced\n");
+        goto cleanup;
+    }
+    // A numeric host resolves, the end carries the getaddrinfo() result
+    if (s_events[resolve_end].arg != 0) {
+        printf("STUN server lookup traced as failed (%d)\n", (int)s_events[resolve_end].arg);
+        goto cleanup;
+    }
+    // Connectivity checks are Binding transactions, their begin carries the method and their end the class
+    size_t answered = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const juice_trace_event_t *ev = &s_events[i];
+        if (ev->stage != JUICE_TRACE_STUN_TRANSACTION || ev->phase != 'b') {
+            continue;
+        }
+        if (ev->arg != STUN_METHOD_BINDING) {
+            printf("STUN transaction begins with method %d\n", (int)ev->arg);
+            goto cleanup;
+        }
+        for (size_t j = i + 1; j < count; ++j) {
+            if (s_events[j].stage == JUICE_TRACE_STUN_TRANSACTION && s_events[j].phase == 'e' &&
+                    s_events[j].id == ev->id) {
+                ++answered;
+                break;
+            }
+        }
+    }
+    if (answered == 0) {
+        printf("No answered Binding transaction traced\n");
+        goto cleanup;
+    }
+
+    for (int a = 0; a < 2; ++a) {
+        const juice_agent_t *agent = s_agents[a];
+        size_t gather = find(count, agent, JUICE_TRACE_GATHER, 'b', -1);
+        size_t local = find(count, agent, JUICE_TRACE_LOCAL_CANDIDATE, 'n', JUICE_TRACE_CANDIDATE_HOST);
+        size_t remote = find(count, agent, JUICE_TRACE_REMOTE_CANDIDATE, 'n', -1);
+        size_t pair = find(count, agent, JUICE_TRACE_PAIR_STATE, 'n', -1);
+        size_t succeeded = find_pair(count, agent, JUICE_TRACE_PAIR_SUCCEEDED);
+        size_t state_connected = find(count, agent, JUICE_TRACE_STATE, 'n', JUICE_STATE_CONNECTED);
+        size_t nomination = find(count, agent, JUICE_TRACE_NOMINATION, 'n', -1);
+        size_t state_completed = find(count, agent, JUICE_TRACE_STATE, 'n', JUICE_STATE_COMPLETED);
+        printf("Agent %d: gather %u, host candidate %u, remote candidate %u, pair %u, succeeded %u, "
+               "connected %u, nomination %u, completed %u (of %u events)\n", a, (unsigned)gather,
+               (unsigned)local, (unsigned)remote, (unsigned)pair, (unsigned)succeeded,
+               (unsigned)state_connected, (unsigned)nomination, (unsigned)state_completed, (unsigned)count);
+        if (!(gather < local && local < count && remote < pair && pair <= succeeded &&
+                succeeded < state_connected && state_connected < count && nomination < state_completed &&
+                state_completed < count)) {
+            printf("Agent %d: connection events missing or out of order\n", a);
+            goto cleanup;
+        }
+    }
+    ret = 0;
+
+cleanup:
+    juice_destroy(s_agents[0]);
+    juice_destroy(s_agents[1]);
+    s_agents[0] = s_agents[1] = NULL;
+    juice_trace_reset();
+    return ret;
+}
+
+int test_trace(void)
+{
+    if (check_ring() || check_connection()) {
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int test_trace(void)
+{
+    printf("CONFIG_ESP_ICE_TRACE is disabled, skipping\n");
+    return 0;
+}
+
+#endif